@@ -26,38 +26,226 @@ SOFTWARE.
 #include <stdio.h>
 #include <curl/curl.h>
 
-#include "tlsb.h"
+#include "tlasxp.h"
 
 
-static size_t discard_write_cb(const void *ptr, size_t size, size_t nmemb, FILE *userdata)
+/* per request state of the write and header callbacks */
+typedef struct _xfer
 {
+    FILE *f;
+    int len;            /* sum of all chunks as with WinHTTP */
+    http_tap_t *tap;
+} xfer_t;
+
+static size_t write_cb(const void *ptr, size_t size, size_t nmemb, void *ref)
+{
+    xfer_t *x = ref;
+    size_t n = size * nmemb;
+
+    if (x->f && n != fwrite(ptr, 1, n, x->f))
+        return 0;
+
+    x->len += n;
+    if (x->tap)
+        tlasxp_http_tap_chunk(x->tap, ptr, n);
+    return n;
+}
+
+static size_t header_cb(char *ptr, size_t size, size_t nmemb, void *ref)
+{
+    xfer_t *x = ref;
+    tlasxp_http_tap_header(x->tap, ptr, size * nmemb);
     return size * nmemb;
 }
 
-int tlsb_http_get(const char *url, FILE *f, int *ret_len, int timeout)
+/* called by curl during the transfer, a non zero return aborts it */
+static int xferinfo_cb(void *ref, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
 {
-  CURL *curl;
-  CURLcode res;
-  curl_global_init(CURL_GLOBAL_ALL);
-  curl = curl_easy_init();
-  if(!curl) return 0;
+    run_ctl_t *rc = ref;
+    if (dlnow > 0 && 0.0 == rc->first_byte)
+        tlasxp_run_first_byte(rc);
+
+    return tlasxp_run_aborted(rc);
+}
+
+struct _native_conn
+{
+    CURLM *multi;       /* the multi handle's connection cache keeps the connection alive */
+    CURL *curl;
+    char base_url[200];
+};
+
+#define POLL_MS 100     /* deadlines are checked that often, a cancel wakes up at once */
+
+static void wake_multi(void *ref)
+{
+  curl_multi_wakeup(ref);
+}
+
+/*
+ * Run the transfer on a multi handle so that tlasxp_run_cancel() can interrupt
+ * curl_multi_poll() with curl_multi_wakeup() instead of waiting for the next
+ * progress callback.
+ */
+static int perform(CURLM *multi, CURL *curl, const char *url, FILE *f, int *ret_len, run_ctl_t *rc,
+                   double timeout, http_tap_t *tap)
+{
+  CURLcode res = CURLE_OK;
+  xfer_t x = { f, 0, tap };
+
   curl_easy_setopt(curl, CURLOPT_URL, url);
-  curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, (NULL != f) ? fwrite : discard_write_cb);
-  curl_easy_setopt(curl, CURLOPT_WRITEDATA, f);
+  curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long)(timeout * 1000.0) + 1);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_cb);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &x);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, tap ? header_cb : NULL);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, tap ? &x : NULL);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  long connect_ms = 0;  /* 0: curl's default */
+  if (rc && rc->first_byte_deadline > 0.0) {
+      connect_ms = (long)((rc->first_byte_deadline - tlasxp_now()) * 1000.0) + 1;
+      if (connect_ms < 1)
+          connect_ms = 1;
+  }
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, connect_ms);
+
+  if (rc) {
+      curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo_cb);
+      curl_easy_setopt(curl, CURLOPT_XFERINFODATA, rc);
+      curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+  } else {
+      curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1L);
+  }
 
   curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
   curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-  res = curl_easy_perform(curl);
+
+  if (CURLM_OK != curl_multi_add_handle(multi, curl)) {
+      log_msg("curl_multi_add_handle() failed");
+      return 0;
+  }
+
+  run_wake_t w;
+  if (rc)
+      tlasxp_run_wake_add(&w, rc, wake_multi, multi);
+
+  int running = 1, done = 0;
+  while (1) {
+      CURLMcode mc = curl_multi_perform(multi, &running);
+      if (CURLM_OK == mc && 0 == running)
+          break;
+
+      if (CURLM_OK == mc && tlasxp_run_aborted(rc)) {
+          res = CURLE_ABORTED_BY_CALLBACK;
+          break;
+      }
+
+      if (CURLM_OK == mc)
+          mc = curl_multi_poll(multi, NULL, 0, POLL_MS, NULL);
+
+      if (CURLM_OK != mc) {
+          log_msg("curl_multi: %s", curl_multi_strerror(mc));
+          res = CURLE_RECV_ERROR;
+          break;
+      }
+  }
+
+  CURLMsg *msg;
+  int n_msg;
+  while (NULL != (msg = curl_multi_info_read(multi, &n_msg)))
+      if (CURLMSG_DONE == msg->msg && curl == msg->easy_handle) {
+          if (CURLE_OK == res)
+              res = msg->data.result;
+          done = 1;
+      }
+
+  if (rc)
+      tlasxp_run_wake_remove(&w);
+  curl_multi_remove_handle(multi, curl);
+
+  if (CURLE_OK == res && ! done)
+      res = CURLE_RECV_ERROR;
+
     /* Check for errors */
   if(res != CURLE_OK) {
-      log_msg("curl_easy_perform() failed: %s\n", curl_easy_strerror(res));
+      log_msg("curl transfer failed: %s\n", curl_easy_strerror(res));
       return 0;
   }
-  double dl;
-  res = curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &dl);
-  if(res == CURLE_OK && ret_len) *ret_len = (int)dl;
-  curl_easy_cleanup(curl);
-  curl_global_cleanup();
+  if (ret_len) *ret_len = x.len;
   return 1;
 }
+
+/*
+ * curl_global_init() is not thread safe on older libcurls so it's done once
+ * before any thread uses curl and undone after the last one is gone.
+ */
+int tlasxp_http_native_init(void)
+{
+  CURLcode res = curl_global_init(CURL_GLOBAL_ALL);
+  if (res != CURLE_OK) {
+      log_msg("curl_global_init() failed: %s", curl_easy_strerror(res));
+      return 0;
+  }
+  return 1;
+}
+
+void tlasxp_http_native_cleanup(void)
+{
+  curl_global_cleanup();
+}
+
+int tlasxp_http_native_get(const char *url, FILE *f, int *ret_len, run_ctl_t *rc, double timeout,
+                           http_tap_t *tap)
+{
+  CURL *curl;
+  int result;
+
+  if (tlasxp_run_aborted(rc)) {
+      log_msg("tlasxp_http_get: run aborted, '%s' not fetched", url);
+      return 0;
+  }
+
+  CURLM *multi = curl_multi_init();
+  curl = curl_easy_init();
+  result = 0;
+  if (multi && curl)
+      result = perform(multi, curl, url, f, ret_len, rc, timeout, tap);
+  if (curl) curl_easy_cleanup(curl);
+  if (multi) curl_multi_cleanup(multi);
+  return result;
+}
+
+native_conn_t *tlasxp_http_native_conn_open(const char *base_url)
+{
+  native_conn_t *conn = calloc(1, sizeof(native_conn_t));
+  if (NULL == conn) return NULL;
+
+  conn->multi = curl_multi_init();
+  conn->curl = curl_easy_init();
+  if (NULL == conn->multi || NULL == conn->curl) {
+      tlasxp_http_native_conn_close(conn);
+      return NULL;
+  }
+
+  snprintf(conn->base_url, sizeof(conn->base_url), "%s", base_url);
+  return conn;
+}
+
+int tlasxp_http_native_conn_get(native_conn_t *conn, const char *path, FILE *f, int *ret_len,
+                                run_ctl_t *rc, double timeout, http_tap_t *tap)
+{
+  char url[500];
+
+  if (tlasxp_run_aborted(rc))
+      return 0;
+
+  snprintf(url, sizeof(url), "%s%s", conn->base_url, path);
+  return perform(conn->multi, conn->curl, url, f, ret_len, rc, timeout, tap);
+}
+
+void tlasxp_http_native_conn_close(native_conn_t *conn)
+{
+  if (NULL == conn) return;
+  if (conn->curl) curl_easy_cleanup(conn->curl);
+  if (conn->multi) curl_multi_cleanup(conn->multi);
+  free(conn);
+}
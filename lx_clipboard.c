@@ -0,0 +1,60 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* clipboard access for Linux through the usual command line tools */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tlasxp.h"
+
+static const char *tools[] = {
+    "wl-paste --no-newline 2>/dev/null",
+    "xclip -o -selection clipboard 2>/dev/null",
+    "xsel --clipboard --output 2>/dev/null",
+    NULL
+};
+
+/* copy the clipboard text into buffer, 0 terminated, return # of bytes */
+int
+get_clipboard(char *buffer, int buflen)
+{
+    buffer[0] = '\0';
+
+    for (const char **t = tools; *t; t++) {
+        FILE *p = popen(*t, "r");
+        if (NULL == p)
+            continue;
+
+        int len = fread(buffer, 1, buflen - 1, p);
+        int res = pclose(p);
+        buffer[len] = '\0';
+
+        if (0 == res && len > 0)
+            return len;
+    }
+
+    log_msg("can't read clipboard");
+    return 0;
+}
@@ -0,0 +1,53 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* clipboard access for macOS */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tlasxp.h"
+
+/* copy the clipboard text into buffer, 0 terminated, return # of bytes */
+int
+get_clipboard(char *buffer, int buflen)
+{
+    buffer[0] = '\0';
+
+    FILE *p = popen("pbpaste", "r");
+    if (NULL == p) {
+        log_msg("can't read clipboard");
+        return 0;
+    }
+
+    int len = fread(buffer, 1, buflen - 1, p);
+    int res = pclose(p);
+    if (0 != res) {
+        log_msg("pbpaste failed: %d", res);
+        len = 0;
+    }
+
+    buffer[len] = '\0';
+    return len;
+}
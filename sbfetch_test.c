@@ -28,17 +28,222 @@ SOFTWARE.
 #include <stdarg.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 #include "tlasxp.h"
 
 char tlasxp_tmp_fn[] = "xml.tmp";
 char pilot_id[20];
 
+#define BATCH_TIMEOUT 30.0
+#define MAX_POOL 32
+
+typedef struct _batch_item
+{
+    char pilot_id[20];
+    char status[100];
+    double t;           /* latency in s */
+    int ok;
+} batch_item_t;
+
+typedef struct _batch
+{
+    batch_item_t *items;
+    int n_items;
+    volatile int next;
+} batch_t;
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static void *
+batch_worker(void *arg)
+{
+    batch_t *b = arg;
+    ofp_info_t *ofp_info = malloc(sizeof(ofp_info_t));
+    if (NULL == ofp_info)
+        return NULL;
+
+    while (1) {
+        int i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+        if (i >= b->n_items)
+            break;
+
+        batch_item_t *bi = &b->items[i];
+        run_ctl_t rc;
+        tlasxp_run_init(&rc, BATCH_TIMEOUT);
+        arena_t arena;
+        tlasxp_arena_init(&arena, 0);
+
+        double t0 = tlasxp_now();
+        tlasxp_ofp_get_parse(bi->pilot_id, ofp_info, &rc, &arena);
+        tlasxp_arena_release(&arena);
+        bi->t = tlasxp_now() - t0;
+        bi->ok = (0 == strcmp(ofp_info->status, "Success"));
+        if (bi->ok)
+            snprintf(bi->status, sizeof(bi->status), "%s%s %s-%s %d fixes",
+                     ofp_info->icao_airline, ofp_info->flight_number,
+                     ofp_info->origin, ofp_info->destination, ofp_info->n_navlog);
+        else
+            snprintf(bi->status, sizeof(bi->status), "%s",
+                     ofp_info->status[0] ? ofp_info->status : "Error");
+
+        printf("%-12s %-4s %7.3f s  %s\n", bi->pilot_id, bi->ok ? "OK" : "FAIL", bi->t, bi->status);
+        fflush(stdout);
+    }
+
+    free(ofp_info);
+    return NULL;
+}
+
+/*
+ * fetch and parse all pilot ids listed in fn ("-" = stdin) with n_pool concurrent workers
+ * Every request opens its own connection and a hedged one a second, so up to
+ * 2 * n_pool connections may be open at a time.
+ */
+static int
+batch(const char *fn, int n_pool)
+{
+    FILE *f = strcmp(fn, "-") ? fopen(fn, "r") : stdin;
+    if (NULL == f) {
+        log_msg("can't open '%s'", fn);
+        return 1;
+    }
+
+    batch_t b = { 0 };
+    int n_alloc = 0;
+    char line[100];
+
+    while (fgets(line, sizeof(line), f)) {
+        char id[20];
+        if (1 != sscanf(line, "%19s", id) || '#' == id[0])
+            continue;
+
+        if (b.n_items == n_alloc) {
+            n_alloc = n_alloc ? 2 * n_alloc : 64;
+            batch_item_t *items = realloc(b.items, n_alloc * sizeof(batch_item_t));
+            if (NULL == items) {
+                log_msg("out of memory");
+                return 1;
+            }
+            b.items = items;
+        }
+
+        memset(&b.items[b.n_items], 0, sizeof(batch_item_t));
+        strcpy(b.items[b.n_items++].pilot_id, id);
+    }
+
+    if (f != stdin)
+        fclose(f);
+
+    if (0 == b.n_items) {
+        log_msg("no pilot ids in '%s'", fn);
+        return 1;
+    }
+
+    if (n_pool < 1) n_pool = 1;
+    if (n_pool > MAX_POOL) n_pool = MAX_POOL;
+    if (n_pool > b.n_items) n_pool = b.n_items;
+
+    pthread_t tid[MAX_POOL];
+    double t0 = tlasxp_now();
+
+    int n_worker = 0;
+    for (int i = 0; i < n_pool; i++)
+        if (0 == pthread_create(&tid[n_worker], NULL, batch_worker, &b))
+            n_worker++;
+
+    if (0 == n_worker)
+        batch_worker(&b);
+
+    for (int i = 0; i < n_worker; i++)
+        pthread_join(tid[i], NULL);
+
+    double t_wall = tlasxp_now() - t0;
+
+    double *lat = malloc(b.n_items * sizeof(double));
+    if (NULL == lat) {
+        log_msg("out of memory");
+        free(b.items);
+        return 1;
+    }
+
+    int n_ok = 0;
+    for (int i = 0; i < b.n_items; i++) {
+        lat[i] = b.items[i].t;
+        n_ok += b.items[i].ok;
+    }
+
+    qsort(lat, b.n_items, sizeof(double), cmp_double);
+#define PCT(p) lat[(int)((p) * (b.n_items - 1))]
+    printf("\n%d pilot ids, %d ok, %d failed, %d workers\n", b.n_items, n_ok, b.n_items - n_ok, n_pool);
+    printf("wall %0.3f s, throughput %0.2f OFP/s\n", t_wall, b.n_items / t_wall);
+    printf("latency s: min %0.3f, p50 %0.3f, p90 %0.3f, p95 %0.3f, p99 %0.3f, max %0.3f\n",
+           lat[0], PCT(0.5), PCT(0.9), PCT(0.95), PCT(0.99), lat[b.n_items - 1]);
+    tlasxp_http_log_stats();
+    tlasxp_latency_log();
+    tlasxp_arena_log_stats();
+
+    free(lat);
+    free(b.items);
+    return (n_ok == b.n_items) ? 0 : 2;
+}
+
+/* list the archive or dump entry seq (if != 0) */
+static int
+history(uint64_t seq)
+{
+    if (seq) {
+        static ofp_info_t ofp_info;
+        double t0 = tlasxp_now();
+        if (! tlasxp_hist_load(seq, &ofp_info))
+            return 2;
+
+        double t = tlasxp_now() - t0;
+        tlasxp_dump_ofp_info(&ofp_info);
+        printf("loaded in %0.3f ms\n", t * 1000.0);
+        return 0;
+    }
+
+    static hist_entry_t entries[HIST_MAX_ENTRIES];
+    double t0 = tlasxp_now();
+    int n = tlasxp_hist_list(entries, HIST_MAX_ENTRIES);
+    double t = tlasxp_now() - t0;
+
+    for (int i = 0; i < n; i++) {
+        hist_entry_t *e = &entries[i];
+        time_t tg = atol(e->time_generated);
+        struct tm tm;
+#ifdef WINDOWS
+        gmtime_s(&tm, &tg);
+#else
+        gmtime_r(&tg, &tm);
+#endif
+        printf("%5llu  %4d-%02d-%02d %02d:%02d  %s%-6s %-4s -> %-4s  %6u bytes\n",
+               (unsigned long long)e->seq, tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+               tm.tm_hour, tm.tm_min, e->icao_airline, e->flight_number, e->origin,
+               e->destination, e->len);
+    }
+
+    printf("%d entries listed in %0.3f ms\n", n, t * 1000.0);
+    return 0;
+}
+
 /*
  * call with
  * sbfetch_test pilot_id
  * or
  * sbfetch_test -c
  * to get from clipboard
+ * or
+ * sbfetch_test -b file [-j n]
+ * to fetch all pilot ids in file (one per line, "-" = stdin) with n concurrent workers
+ * or
+ * sbfetch_test -a archive [seq]
+ * to list the OFP history archive (base name without .idx/.dat) or dump entry seq
  */
 int
 main(int argc, char** argv)
@@ -48,10 +253,40 @@ main(int argc, char** argv)
         exit(1);
     }
 
+    tlasxp_http_init();
+
+    if (0 == strcmp(argv[1], "-b")) {
+        if (argc < 3) {
+            log_msg("missing batch file");
+            exit(1);
+        }
+
+        int n_pool = 4;
+        if (argc >= 5 && 0 == strcmp(argv[3], "-j"))
+            n_pool = atoi(argv[4]);
+
+        exit(batch(argv[2], n_pool));
+    }
+
+    if (0 == strcmp(argv[1], "-a")) {
+        if (argc < 3) {
+            log_msg("missing archive");
+            exit(1);
+        }
+
+        tlasxp_hist_init(argv[2]);
+        exit(history(argc >= 4 ? strtoull(argv[3], NULL, 10) : 0));
+    }
+
     strncpy(pilot_id, argv[1], sizeof(pilot_id) - 1);
 
     ofp_info_t ofp_info;
-    tlasxp_ofp_get_parse(pilot_id, &ofp_info);
+    run_ctl_t rc;
+    tlasxp_run_init(&rc, 15.0);
+    arena_t arena;
+    tlasxp_arena_init(&arena, 0);
+    tlasxp_ofp_get_parse(pilot_id, &ofp_info, &rc, &arena);
+    tlasxp_arena_release(&arena);
     tlasxp_dump_ofp_info(&ofp_info);
     time_t tg = atol(ofp_info.time_generated);
     log_msg("tg %u", tg);
@@ -23,6 +23,7 @@ SOFTWARE.
 */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
@@ -30,6 +31,7 @@ SOFTWARE.
 #include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "XPLMPlugin.h"
 #include "XPLMPlanes.h"
@@ -50,20 +52,45 @@ SOFTWARE.
 
 #define LB_2_KG 0.45359237    /* imperial to metric */
 
+#define FETCH_BUDGET 15.0       /* overall deadline of a fetch pipeline run */
+#define FMS_STAGE_SHARE 0.7     /* FMS download's share of what is left, ASXP gets the rest */
+#define FMS_STAGE_CAP 10.0
+#define WX_STAGE_CAP 3.0
+#define PREFETCH_BUDGET (50 * 1024 * 1024)
+#define XML_CLIPBOARD (-1)      /* xml_len of start_fetch: read the clipboard on the worker */
+
+/* changes of a re-fetched OFP that trigger the downstream actions */
+#define FMS_CHANGES (OFP_CHG_AIRPORTS | OFP_CHG_RWY | OFP_CHG_ROUTE | OFP_CHG_CRZ)
+#define WX_CHANGES (OFP_CHG_AIRPORTS | OFP_CHG_ALTN | OFP_CHG_ROUTE | OFP_CHG_TIMES)
+
+#define N_WX_LINES MAX_WX
+#define DISPLAY_HEIGHT 150
+#define MAX_DRAW_LIST 12
+
+#define FWD_CARGO_SHARE 0.45    /* of bags + freight, rest goes aft */
+
+/* what to xfer to the ISCS */
+#define XFER_FUEL 1
+#define XFER_PAYLOAD 2
+
 static float flight_loop_cb(float unused1, float unused2, int unused3, void *unused4);
+static float fetch_poll_cb(float unused1, float unused2, int unused3, void *unused4);
+static float xfer_loop_cb(float unused1, float unused2, int unused3, void *unused4);
+static float import_loop_cb(float unused1, float unused2, int unused3, void *unused4);
 
 static char xpdir[512];
 static const char *psep;
-static char fms_path[512];
+static char fms_path[600];
+static char cache_path[600];
 
-char tlasxp_tmp_fn[512];
+char tlasxp_tmp_fn[600];
 
 static XPLMMenuID tlasxp_menu;
 
-#define MSG_GET_OFP (xpMsg_UserStart + 1)
 static XPWidgetID getofp_widget, display_widget, getofp_btn,
                   status_line,
-                  xfer_fuel_btn, xfer_payload_btn, xfer_all_btn;
+                  xfer_fuel_btn, xfer_payload_btn, xfer_all_btn,
+                  wx_line[N_WX_LINES];
 static XPWidgetID conf_widget, conf_downl_fpl_btn, pilot_id_input, conf_ok_btn;
 
 #ifdef UPLOAD_ASXP
@@ -79,11 +106,28 @@ typedef struct _widget_ctx
 
 static widget_ctx_t getofp_widget_ctx, conf_widget_ctx;
 
-static ofp_info_t ofp_info;
+static wx_info_t wx_info;
+
+/*
+ * The OFP summary in display_widget is laid out once into a draw list
+ * whenever the displayed data changes. Drawing just replays the list.
+ */
+typedef struct _draw_line
+{
+    int dy;             /* from top of the widget */
+    char text[100];
+} draw_line_t;
+
+static draw_line_t draw_list[MAX_DRAW_LIST];
+static int n_draw_list;
+static int display_dirty = 1;
+static int draw_list_width;     /* widget width the layout was made for */
 
 static XPLMDataRef vr_enabled_dr,
                    acf_icao_dr,
-                   mcdu1_spw_dr, mcdu2_spw_dr;
+                   mcdu1_spw_dr, mcdu2_spw_dr,
+                   write_fob_dr, no_pax_dr, fwd_cargo_dr, aft_cargo_dr;
+static XPLMCommandRef set_weight_cmdr;
 
 static XPLMCreateFlightLoop_t create_flight_loop =
 {
@@ -93,15 +137,78 @@ static XPLMCreateFlightLoop_t create_flight_loop =
 };
 static XPLMFlightLoopID flight_loop_id;
 
-static int dr_mapped;
+static XPLMCreateFlightLoop_t create_fetch_poll_loop =
+{
+    .structSize = sizeof(XPLMCreateFlightLoop_t),
+    .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+    .callbackFunc = fetch_poll_cb
+};
+static XPLMFlightLoopID fetch_poll_loop_id;
+
+static XPLMCreateFlightLoop_t create_xfer_loop =
+{
+    .structSize = sizeof(XPLMCreateFlightLoop_t),
+    .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+    .callbackFunc = xfer_loop_cb
+};
+static XPLMFlightLoopID xfer_loop_id;
+
+static XPLMCreateFlightLoop_t create_import_loop =
+{
+    .structSize = sizeof(XPLMCreateFlightLoop_t),
+    .phase = xplm_FlightLoop_Phase_BeforeFlightModel,
+    .callbackFunc = import_loop_cb
+};
+static XPLMFlightLoopID import_loop_id;
+
+/* load data for the ISCS, computed at the button press, written in one flight loop */
+static struct {
+    int what;
+    float fob, n_pax, fwd_cargo, aft_cargo;     /* kg */
+} xfer;
+
+/*
+ * The fetch pipeline runs on a worker thread. The worker only touches the fetch_*
+ * variables below, the flight loop collects the result after the worker has finished.
+ */
+static pthread_t fetch_thread;
+static int fetch_running;           /* worker started and not yet joined, main thread only */
+static volatile int fetch_finished; /* set by worker */
+static int fetch_show_on_error;
+static int fetch_xfer;              /* xfer load data after a successful fetch */
+static run_ctl_t fetch_rc;
+static char fetch_pilot_id[20];
+static char *fetch_xml;             /* imported OFP xml, NULL = fetch from SimBrief */
+static int fetch_xml_len;          /* or XML_CLIPBOARD */
+static uint64_t fetch_hist_before;  /* != 0: load an archived OFP older than that seq */
+static uint64_t fetch_hist_seq;     /* seq of the archived OFP loaded, set by worker */
+static int fetch_no_input;          /* the source had no OFP, the current one stays, set by worker */
+static int fetch_imported;          /* not from SimBrief, set before the worker starts */
+static ofp_info_t fetch_ofp_info;
+static wx_info_t fetch_wx_info;
+static const ofp_info_t *fetch_prev;   /* snapshot the fetch is diffed against, referenced */
+static wx_info_t prev_wx_info;
+static unsigned fetch_changes;      /* OFP_CHG_* against fetch_prev */
+static char fetch_msg_1[100], fetch_msg_2[100], fetch_msg_3[100];  /* become the msg_lines */
+static uint64_t uploaded_hash;      /* of the FMS plan last uploaded to ASXP, worker only */
+static unsigned uploaded_gen;       /* tlasxp_asxp_generation() it was uploaded in */
+
+static int dr_mapped, load_dr_mapped;
 static int error_disabled;
 
 static char pref_path[512];
 static char pilot_id[20];
 static int flag_download_fms, flag_upload_aspx;
+static int httpd_port;      /* 0 = LAN server disabled */
+static char import_dir[512];    /* drop folder for offline OFPs, empty = default */
+static char import_ref;         /* menu item */
+static char hist_ref;           /* menu item */
+static uint64_t hist_shown;     /* seq of the archived OFP on display, 0 = none */
 static char acf_file[256];
 static char acf_icao[41];
 static char msg_line_1[100], msg_line_2[100], msg_line_3[100];
+static int toliss_loaded;
+static int subsys_up;        /* the ToLiss only subsystems are running */
 
 
 static void
@@ -114,10 +221,23 @@ map_datarefs()
     if (NULL == (mcdu2_spw_dr = XPLMFindDataRef("AirbusFBW/MCDU2spw"))) goto err;
 
     dr_mapped = 1;
+
+    /* ISCS load datarefs, resolved once */
+    if (NULL == (write_fob_dr = XPLMFindDataRef("AirbusFBW/WriteFOB"))) goto err_load;
+    if (NULL == (no_pax_dr = XPLMFindDataRef("AirbusFBW/NoPax"))) goto err_load;
+    if (NULL == (fwd_cargo_dr = XPLMFindDataRef("AirbusFBW/FwdCargo"))) goto err_load;
+    if (NULL == (aft_cargo_dr = XPLMFindDataRef("AirbusFBW/AftCargo"))) goto err_load;
+    if (NULL == (set_weight_cmdr = XPLMFindCommand("AirbusFBW/SetWeightAndCG"))) goto err_load;
+
+    load_dr_mapped = 1;
     return;
 
 err:
     log_msg("Can't map all datarefs, disabled");
+    return;
+
+err_load:
+    log_msg("Can't map ISCS datarefs, load data xfer disabled");
 }
 
 static void
@@ -130,6 +250,9 @@ save_pref()
     fputs(pilot_id, f); putc('\n', f);
     putc((flag_download_fms ? '1' : '0'), f); putc('\n', f);
     putc((flag_upload_aspx ? '1' : '0'), f); putc('\n', f);
+    fprintf(f, "%d\n", httpd_port);
+    fputs(import_dir, f); putc('\n', f);
+    fprintf(f, "%d\n", (int)(tlasxp_arena_cap / (1024 * 1024)));
     fclose(f);
 }
 
@@ -152,6 +275,20 @@ load_pref()
 
     if (EOF == (c = fgetc(f))) goto out;
     flag_upload_aspx = (c == '1' ? 1 : 0);
+    fgetc(f);
+
+    if (1 != fscanf(f, "%d", &httpd_port)) httpd_port = 0;
+    fgetc(f);
+
+    if (NULL == fgets(import_dir, sizeof(import_dir), f)) goto out;
+    len = strlen(import_dir);
+    if (len > 0 && '\n' == import_dir[len - 1]) import_dir[--len] = '\0';
+    if (len > 0 && len < (int)sizeof(import_dir) - 2 && 0 != strcmp(import_dir + len - 1, psep))
+        strcat(import_dir, psep);
+
+    int cap_mb;     /* of the per fetch arena */
+    if (1 == fscanf(f, "%d", &cap_mb) && cap_mb > 0 && cap_mb <= 1024)
+        tlasxp_arena_cap = (size_t)cap_mb * 1024 * 1024;
 
   out:
     flag_upload_aspx &= flag_download_fms;
@@ -159,51 +296,111 @@ load_pref()
 }
 
 static void
-download_fms()
+fms_filename(const ofp_info_t *oi, char *fn, int len)
 {
-    char URL[300], fn[500];
-    FILE *f = NULL;
-
-    tlasxp_dump_ofp_info(&ofp_info);
+    snprintf(fn, len, "%s%s%s%s19.fms", fms_path, psep, oi->origin, oi->destination);
+}
 
-    snprintf(URL, sizeof(URL), "%s%s", ofp_info.sb_path, ofp_info.sb_fms_link);
-    log_msg("URL '%s'", URL);
-    snprintf(fn, sizeof(fn), "%s%s%s%s19.fms", fms_path, psep, ofp_info.origin, ofp_info.destination);
+/*
+ * runs on the worker thread
+ * An unchanged plan is uploaded anyway unless ASXP got it since it came up.
+ */
+static void
+upload_fms(const ofp_info_t *oi, uint64_t hash, int unchanged, run_ctl_t *rc)
+{
+    char fn[100];
 
-    if (NULL == (f = fopen(fn, "wb"))) {
-        log_msg("Can't create file '%s'", fn);
-        goto err_out;
+    if (unchanged && hash == uploaded_hash && tlasxp_asxp_generation() == uploaded_gen) {
+        strcpy(fetch_msg_3, "Flightplan unchanged, not reloaded");
+        return;
     }
 
-    if (0 == tlasxp_http_get(URL, f, NULL, 10)) {
-        log_msg("Can't download '%s'", URL);
-        goto err_out;
+    snprintf(fn, sizeof(fn), "%s%s19.fms", oi->origin, oi->destination);
+
+    if (0 == tlasxp_asxp_upload(fn, rc)) {
+        strcpy(fetch_msg_3, "ASXP not available, upload deferred");
+    } else {
+        uploaded_hash = hash;
+        uploaded_gen = tlasxp_asxp_generation();
+        strcpy(fetch_msg_3, "Flightplan uploaded to ASXP");
     }
+}
 
-    snprintf(msg_line_2, sizeof(msg_line_2), "FMS plan: '%s%s19'", ofp_info.origin, ofp_info.destination);
+/*
+ * runs on the worker thread, return success == 1
+ * The plan is downloaded into a temp file and atomically renamed so readers
+ * never see a partial file. An unchanged plan is neither rewritten nor reloaded by ASXP.
+ * For an imported OFP there is no network so the plan is generated from the navlog.
+ */
+static int
+download_fms(ofp_info_t *oi, run_ctl_t *rc)
+{
+    char URL[300], fn[700], tmp_fn[710];
+    FILE *f = NULL;
+    uint64_t hash_new = 0, hash_old;
+    int res = 0;
 
-    snprintf(URL, sizeof(URL), "http://localhost:19285/ActiveSky/API/LoadFlightPlan?FileName=%s%s19.fms",
-                               ofp_info.origin, ofp_info.destination);
-    log_msg("URL '%s'", URL);
+    fms_filename(oi, fn, sizeof(fn));
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
 
-    if (0 == tlasxp_http_get(URL, NULL, NULL, 2)) {
-        log_msg("Can't upload to ASXP '%s'", URL);
-        strcpy(msg_line_3, "Could not upload flightplan to ASXP");
+    if (fetch_imported) {
+        if (0 == tlasxp_import_fms(oi, tmp_fn))
+            goto err_out;
     } else {
-        strcpy(msg_line_3, "Flightplan uploaded to ASXP");
+        snprintf(URL, sizeof(URL), "%s%s", oi->sb_path, oi->sb_fms_link);
+        log_msg("URL '%s'", URL);
+
+        /* instances on the same host share the daemon's download */
+        int sc = tlasxp_sidecar_fms(URL, tmp_fn, rc);
+        if (0 == sc) {
+            log_msg("Can't download '%s'", URL);
+            goto err_out;
+        }
+
+        if (sc < 0) {
+            if (NULL == (f = fopen(tmp_fn, "wb"))) {
+                log_msg("Can't create file '%s'", tmp_fn);
+                goto err_out;
+            }
+
+            if (0 == tlasxp_http_get_retry(URL, f, NULL, rc, tlasxp_stage_timeout(rc, FMS_STAGE_SHARE, FMS_STAGE_CAP))) {
+                log_msg("Can't download '%s'", URL);
+                goto err_out;
+            }
+
+            fclose(f);
+            f = NULL;
+        }
     }
 
+    snprintf(fetch_msg_2, sizeof(fetch_msg_2), "FMS plan: '%s%s19'", oi->origin, oi->destination);
+
+    int unchanged = tlasxp_file_hash(tmp_fn, &hash_new) && tlasxp_file_hash(fn, &hash_old)
+                    && hash_new == hash_old;
+    if (unchanged) {
+        log_msg("FMS plan '%s' is unchanged", fn);
+    } else if (! tlasxp_replace_file(tmp_fn, fn)) {
+        log_msg("Can't rename '%s' to '%s'", tmp_fn, fn);
+        goto err_out;
+    }
+
+    res = 1;    /* the plan is in place, ASXP may pick it up later */
+    upload_fms(oi, hash_new, unchanged, rc);
+
   err_out:
     if (f) fclose(f);
+    remove(tmp_fn);     /* unchecked, gone after a successful rename */
+    return res;
 }
 
-
 static void
 show_widget(widget_ctx_t *ctx)
 {
     if (XPIsWidgetVisible(ctx->widget))
         return;
 
+    double t0 = tlasxp_prof_begin();
+
     /* force window into visible area of screen
        we use modern windows under the hut so UI coordinates are in boxels */
 
@@ -239,11 +436,13 @@ show_widget(widget_ctx_t *ctx)
             ctx->in_vr = 0;
         }
     }
+
+    tlasxp_prof_end(PROF_SHOW_WIDGET, t0);
 }
 
 
 static int
-conf_widget_cb(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intptr_t param2)
+conf_widget_msg(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intptr_t param2)
 {
     if (msg == xpMessage_CloseButtonPushed) {
         XPHideWidget(widget_id);
@@ -267,56 +466,481 @@ conf_widget_cb(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intpt
     return 0;
 }
 
-/* return success == 1 */
 static int
-fetch_ofp(void)
+conf_widget_cb(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intptr_t param2)
 {
-    msg_line_1[0] = msg_line_2[0] = msg_line_3[0] = '\0';
+    double t0 = tlasxp_prof_begin();
+    int res = conf_widget_msg(msg, widget_id, param1, param2);
+    tlasxp_prof_end(PROF_CONF_WIDGET, t0);
+    return res;
+}
+
+/*
+ * runs on the worker thread
+ * Load the newest archived OFP older than fetch_hist_before, skipping the one on display.
+ */
+static void
+load_hist(void)
+{
+    hist_entry_t entries[HIST_MAX_ENTRIES];
+    int n = tlasxp_hist_list(entries, HIST_MAX_ENTRIES);
+
+    for (int i = 0; i < n; i++) {
+        const hist_entry_t *e = &entries[i];
+        if (e->seq >= fetch_hist_before)
+            continue;
+
+        if (fetch_prev->valid && 0 == strcmp(e->time_generated, fetch_prev->time_generated)
+            && 0 == strcmp(e->origin, fetch_prev->origin)
+            && 0 == strcmp(e->destination, fetch_prev->destination))
+            continue;
+
+        log_msg("loading OFP #%llu from history", (unsigned long long)e->seq);
+        if (tlasxp_hist_load(e->seq, &fetch_ofp_info)) {
+            fetch_hist_seq = e->seq;
+        } else {
+            strcpy(fetch_ofp_info.status, "Can't load OFP from history");
+            fetch_no_input = 1;
+        }
+        return;
+    }
+
+    strcpy(fetch_ofp_info.status, "No older OFP in history");
+    fetch_no_input = 1;
+}
+
+/* runs on the worker thread, popen of the clipboard tool can take a while */
+static void
+read_clipboard(arena_t *arena)
+{
+    char *xml = tlasxp_arena_alloc(arena, MAX_IMPORT_SIZE);
+    if (NULL == xml) {
+        strcpy(fetch_ofp_info.status, "Out of memory");
+        fetch_no_input = 1;
+        return;
+    }
+
+    int len = get_clipboard(xml, MAX_IMPORT_SIZE);
+    if (len <= 0 || NULL == strstr(xml, "<OFP>") || NULL == strstr(xml, "</OFP>")) {
+        strcpy(fetch_ofp_info.status, "No OFP in clipboard");
+        fetch_no_input = 1;
+        return;
+    }
+
+    log_msg("OFP imported from clipboard, %d bytes", len);
+    tlasxp_ofp_parse(xml, len, &fetch_ofp_info, arena);
+}
+
+static void *
+fetch_worker(void *arg)
+{
+    run_ctl_t *rc = arg;
+    arena_t arena;  /* all allocations of the fetch, released in one step */
+
+    tlasxp_arena_init(&arena, 0);
+
+    if (fetch_hist_before) {
+        load_hist();
+    } else if (XML_CLIPBOARD == fetch_xml_len) {
+        read_clipboard(&arena);
+    } else if (fetch_xml) {
+        tlasxp_ofp_parse(fetch_xml, fetch_xml_len, &fetch_ofp_info, &arena);
+    } else {
+        /* prefer the fetch daemon if there is one */
+        if (tlasxp_sidecar_fetch(fetch_pilot_id, &fetch_ofp_info, rc) < 0)
+            tlasxp_ofp_get_parse(fetch_pilot_id, &fetch_ofp_info, rc, &arena);
+    }
+    tlasxp_dump_ofp_info(&fetch_ofp_info);
+
+    if (0 == strcmp(fetch_ofp_info.status, "Success")) {
+        char fn[700];
+
+        fetch_ofp_info.valid = 1;
+        fetch_ofp_info.fms_source = 0;
+        fetch_changes = tlasxp_ofp_diff(fetch_prev, &fetch_ofp_info, fetch_msg_1, sizeof(fetch_msg_1));
+
+        /*
+         * Only a plan that was successfully downloaded from SimBrief and is still
+         * on disk stands in for an unchanged one. A plan generated from an import
+         * may differ from SimBrief's, and imports are local so they just rerun.
+         * Only the download is skipped, a restarted ASXP still gets the plan.
+         */
+        uint64_t hash;
+        fms_filename(&fetch_ofp_info, fn, sizeof(fn));
+        if (! (fetch_changes & FMS_CHANGES) && ! fetch_imported && fetch_prev
+            && FMS_SRC_SIMBRIEF == fetch_prev->fms_source && tlasxp_file_hash(fn, &hash)) {
+            fetch_ofp_info.fms_source = FMS_SRC_SIMBRIEF;
+            snprintf(fetch_msg_2, sizeof(fetch_msg_2), "FMS plan: '%s%s19'",
+                     fetch_ofp_info.origin, fetch_ofp_info.destination);
+            upload_fms(&fetch_ofp_info, hash, 1, rc);
+        } else if (download_fms(&fetch_ofp_info, rc)) {
+            fetch_ofp_info.fms_source = fetch_imported ? FMS_SRC_IMPORT : FMS_SRC_SIMBRIEF;
+        }
+
+        if (fetch_changes && 0 == fetch_hist_seq)
+            tlasxp_hist_append(&fetch_ofp_info, &arena);
+
+        /* the weather stage is skipped right away if ASXP is down */
+        if (! (fetch_changes & WX_CHANGES) && tlasxp_wx_current(&prev_wx_info))
+            fetch_wx_info = prev_wx_info;
+        else if (ASXP_UP == tlasxp_asxp_state())
+            tlasxp_wx_prefetch(&fetch_ofp_info, &fetch_wx_info, rc,
+                               tlasxp_stage_timeout(rc, 1.0, WX_STAGE_CAP));
+
+        if (fetch_changes)
+            tlasxp_httpd_publish(&fetch_ofp_info, fn);
+    }
+
+    tlasxp_arena_release(&arena);
+    tlasxp_http_log_stats();
+    tlasxp_latency_log();
+    tlasxp_arena_log_stats();
+
+    __atomic_store_n(&fetch_finished, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/* abort a running fetch, returns immediately */
+static void
+cancel_fetch(const char *reason)
+{
+    if (! fetch_running)
+        return;
+
+    log_msg("cancel fetch: %s", reason);
+    tlasxp_run_cancel(&fetch_rc);
+}
+
+/* wait for a (canceled) worker to terminate */
+static void
+join_fetch(void)
+{
+    if (! fetch_running)
+        return;
+
+    pthread_join(fetch_thread, NULL);
+    fetch_running = 0;
+    free(fetch_xml);
+    fetch_xml = NULL;
+    tlasxp_snap_release(fetch_prev);
+    fetch_prev = NULL;
+    tlasxp_prefetch_hold(0);
+}
+
+/*
+ * start the fetch pipeline in the background, return success == 1
+ * With xml != NULL it runs on that imported OFP instead of SimBrief's, the
+ * buffer is owned by the pipeline then.
+ * With xml == NULL and xml_len == XML_CLIPBOARD it runs on the clipboard's content.
+ * With hist_before != 0 it runs on the newest archived OFP older than that.
+ */
+static int
+start_fetch(int show_on_error, int xfer_load, char *xml, int xml_len, uint64_t hist_before)
+{
+    if (! subsys_up) {
+        log_msg("no ToLiss loaded, fetch ignored");
+        free(xml);
+        return 0;
+    }
+
+    if (fetch_running) {
+        if (xml || XML_CLIPBOARD == xml_len || hist_before)
+            cancel_fetch("OFP imported");   /* the user's explicit choice wins */
 
-    ofp_info.valid = 0;
+        if (! fetch_rc.canceled) {
+            log_msg("fetch already in progress");
+            return 0;
+        }
 
-    tlasxp_ofp_get_parse(pilot_id, &ofp_info);
-    tlasxp_dump_ofp_info(&ofp_info);
+        join_fetch();   /* a canceled worker terminates quickly */
+    }
 
-    if (strcmp(ofp_info.status, "Success")) {
-        //XPSetWidgetDescriptor(status_line, ofp_info.status);
-        return 0; // error
+    msg_line_1[0] = msg_line_2[0] = msg_line_3[0] = '\0';
+    fetch_msg_1[0] = fetch_msg_2[0] = fetch_msg_3[0] = '\0';
+    display_dirty = 1;
+    memset(&fetch_ofp_info, 0, sizeof(fetch_ofp_info));
+    memset(&fetch_wx_info, 0, sizeof(fetch_wx_info));
+    fetch_prev = tlasxp_snap_acquire();
+    prev_wx_info = wx_info;
+    fetch_changes = 0;
+    strcpy(fetch_pilot_id, pilot_id);
+    fetch_show_on_error = show_on_error;
+    fetch_xfer = xfer_load;
+    fetch_finished = 0;
+    fetch_xml = xml;
+    fetch_xml_len = xml_len;
+    fetch_hist_before = hist_before;
+    fetch_hist_seq = 0;
+    fetch_no_input = 0;
+    fetch_imported = (NULL != xml || XML_CLIPBOARD == xml_len || 0 != hist_before);
+    tlasxp_run_init(&fetch_rc, FETCH_BUDGET);
+
+    if (pthread_create(&fetch_thread, NULL, fetch_worker, &fetch_rc)) {
+        log_msg("can't create fetch thread");
+        tlasxp_snap_release(fetch_prev);
+        fetch_prev = NULL;
+        free(fetch_xml);
+        fetch_xml = NULL;
+        return 0;
     }
 
+    fetch_running = 1;
+    tlasxp_prefetch_hold(1);    /* the fetch has priority over asset prefetches */
 
-    ofp_info.valid = 1;
+    if (status_line)
+        XPSetWidgetDescriptor(status_line, fetch_imported ? "Importing..." : "Fetching...");
 
-    download_fms();
+    if (NULL == fetch_poll_loop_id)
+        fetch_poll_loop_id = XPLMCreateFlightLoop(&create_fetch_poll_loop);
+    XPLMScheduleFlightLoop(fetch_poll_loop_id, -1.0, 1);
     return 1;
 }
 
+/* prepare xfer of load data from the OFP to the ISCS */
+static void
+xfer_load_data(int what)
+{
+    map_datarefs();
+    if (! load_dr_mapped) {
+        if (status_line)
+            XPSetWidgetDescriptor(status_line, "ISCS not available");
+        return;
+    }
+
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+    if (! ofp->valid) {
+        tlasxp_snap_release(ofp);
+        if (status_line)
+            XPSetWidgetDescriptor(status_line, "No valid OFP");
+        return;
+    }
+
+    float f = (0 == strcmp(ofp->units, "lbs")) ? LB_2_KG : 1.0f;
+
+    if (what & XFER_FUEL)
+        xfer.fob = f * atof(ofp->fuel_plan_ramp);
+
+    if (what & XFER_PAYLOAD) {
+        int n_pax = atoi(ofp->pax_count);
+        float cargo = f * (atof(ofp->payload) - n_pax * atof(ofp->pax_weight));
+        if (cargo < 0.0f)
+            cargo = 0.0f;
+
+        xfer.n_pax = n_pax;
+        xfer.fwd_cargo = FWD_CARGO_SHARE * cargo;
+        xfer.aft_cargo = cargo - xfer.fwd_cargo;
+    }
+
+    tlasxp_snap_release(ofp);
+    xfer.what |= what;
+
+    if (NULL == xfer_loop_id)
+        xfer_loop_id = XPLMCreateFlightLoop(&create_xfer_loop);
+    XPLMScheduleFlightLoop(xfer_loop_id, -1.0, 1);
+}
+
+/* apply all pending ISCS writes in one go so the aircraft never sees a partial load */
+static float
+xfer_loop(float unused1, float unused2, int unused3, void *unused4)
+{
+    if (xfer.what & XFER_FUEL)
+        XPLMSetDataf(write_fob_dr, xfer.fob);
+
+    if (xfer.what & XFER_PAYLOAD) {
+        XPLMSetDataf(no_pax_dr, xfer.n_pax);
+        XPLMSetDataf(fwd_cargo_dr, xfer.fwd_cargo);
+        XPLMSetDataf(aft_cargo_dr, xfer.aft_cargo);
+        XPLMCommandOnce(set_weight_cmdr);
+    }
+
+    log_msg("xfer to ISCS: fob: %0.0f, pax: %0.0f, fwd cargo: %0.0f, aft cargo: %0.0f",
+            xfer.fob, xfer.n_pax, xfer.fwd_cargo, xfer.aft_cargo);
+
+    if (status_line)
+        XPSetWidgetDescriptor(status_line, "Load data transferred to ISCS");
+
+    xfer.what = 0;
+    return 0;
+}
+
+static float
+xfer_loop_cb(float unused1, float unused2, int unused3, void *unused4)
+{
+    double t0 = tlasxp_prof_begin();
+    float res = xfer_loop(unused1, unused2, unused3, unused4);
+    tlasxp_prof_end(PROF_XFER_LOOP, t0);
+    return res;
+}
+
+static void
+add_draw_line(int *dy, int line_height, const char *fmt, ...)
+{
+    if (n_draw_list >= MAX_DRAW_LIST)
+        return;
+
+    va_list ap;
+    va_start(ap, fmt);
+    draw_line_t *dl = &draw_list[n_draw_list++];
+    vsnprintf(dl->text, sizeof(dl->text), fmt, ap);
+    va_end(ap);
+
+    dl->dy = *dy;
+    *dy += line_height;
+}
+
+/* lay out the OFP summary for a widget of width w */
+static void
+layout_display(int w)
+{
+    int char_width, char_height;
+    XPLMGetFontDimensions(xplmFont_Basic, &char_width, &char_height, NULL);
+
+    int lh = char_height + 4;
+    int dy = lh;
+    n_draw_list = 0;
+    draw_list_width = w;
+    display_dirty = 0;
+
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+    if (! ofp->valid) {
+        tlasxp_snap_release(ofp);
+        return;
+    }
+
+    add_draw_line(&dy, lh, "Flight: %s%s  %s", ofp->icao_airline, ofp->flight_number,
+                  ofp->aircraft_icao);
+    add_draw_line(&dy, lh, "%s/%s -> %s/%s  Altn: %s", ofp->origin, ofp->origin_rwy,
+                  ofp->destination, ofp->destination_rwy, ofp->alternate);
+
+    time_t tg = atol(ofp->time_generated);
+    struct tm tm;
+#ifdef WINDOWS
+    gmtime_s(&tm, &tg);
+#else
+    gmtime_r(&tg, &tm);
+#endif
+    int ete = atoi(ofp->est_time_enroute);
+    add_draw_line(&dy, lh, "Generated: %4d-%02d-%02d %02d:%02d UTC  ETE: %d:%02d",
+                  tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+                  ete / 3600, (ete / 60) % 60);
+    add_draw_line(&dy, lh, "Block fuel: %s %s  ZFW: %s  Pax: %s", ofp->fuel_plan_ramp, ofp->units,
+                  ofp->est_zfw, ofp->pax_count);
+    add_draw_line(&dy, lh, "CRZ: %s ft  Wind comp: %s  ISA dev: %s", ofp->altitude,
+                  ofp->wind_component, ofp->isa_dev);
+
+    /* route, wrapped at blanks */
+    int max_chars = w / (char_width > 0 ? char_width : 8) - 1;
+    if (max_chars > (int)sizeof(draw_list[0].text) - 1)
+        max_chars = sizeof(draw_list[0].text) - 1;
+
+    const char *r = ofp->route;
+    while (*r && n_draw_list < MAX_DRAW_LIST - 3) {
+        int len = strlen(r);
+        if (len > max_chars) {
+            len = max_chars;
+            while (len > 0 && r[len] != ' ')
+                len--;
+            if (0 == len)
+                len = max_chars;
+        }
+
+        add_draw_line(&dy, lh, "%.*s", len, r);
+        r += len;
+        while (*r == ' ')
+            r++;
+    }
+
+    if (msg_line_1[0])
+        add_draw_line(&dy, lh, "%s", msg_line_1);
+    if (msg_line_2[0])
+        add_draw_line(&dy, lh, "%s", msg_line_2);
+    if (msg_line_3[0])
+        add_draw_line(&dy, lh, "%s", msg_line_3);
+
+    tlasxp_snap_release(ofp);
+}
+
+static void
+draw_display(void)
+{
+    static float color[] = { 0.0, 0.0, 0.0 };
+    int l, t, r, b;
+
+    XPGetWidgetGeometry(display_widget, &l, &t, &r, &b);
+
+    if (display_dirty || r - l != draw_list_width)
+        layout_display(r - l);
+
+    for (int i = 0; i < n_draw_list; i++)
+        XPLMDrawString(color, l, t - draw_list[i].dy, draw_list[i].text, NULL, xplmFont_Basic);
+}
+
 static int
-getofp_widget_cb(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intptr_t param2)
+getofp_widget_msg(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intptr_t param2)
 {
     if (msg == xpMessage_CloseButtonPushed) {
         XPHideWidget(widget_id);
         return 1;
     }
 
+    if ((widget_id == display_widget) && (msg == xpMsg_Draw)) {
+        draw_display();
+        return 1;
+    }
+
     if (error_disabled)
         return 1;
 
     if ((widget_id == getofp_btn) && (msg == xpMsg_PushButtonPressed)) {
-        XPSetWidgetDescriptor(status_line, "Fetching...");
-        /* Send message to myself to get a draw cycle (draws button as selected) */
-        XPSendMessageToWidget(status_line, MSG_GET_OFP, xpMode_UpChain, 0, 0);
+        (void)start_fetch(0, 0, NULL, 0, 0);
         return 1;
     }
 
-    /* self sent message: fetch OFP (lengthy) */
-    if ((widget_id == getofp_widget) && (MSG_GET_OFP == msg)) {
-        (void)fetch_ofp();
-        return 1;
+    if (msg == xpMsg_PushButtonPressed) {
+        if (widget_id == xfer_fuel_btn) {
+            xfer_load_data(XFER_FUEL);
+            return 1;
+        }
+
+        if (widget_id == xfer_payload_btn) {
+            xfer_load_data(XFER_PAYLOAD);
+            return 1;
+        }
+
+        if (widget_id == xfer_all_btn) {
+            xfer_load_data(XFER_FUEL | XFER_PAYLOAD);
+            return 1;
+        }
     }
 
     return 0;
 }
 
+static int
+getofp_widget_cb(XPWidgetMessage msg, XPWidgetID widget_id, intptr_t param1, intptr_t param2)
+{
+    double t0 = tlasxp_prof_begin();
+    int res = getofp_widget_msg(msg, widget_id, param1, param2);
+    tlasxp_prof_end(PROF_GETOFP_WIDGET, t0);
+    return res;
+}
+
+static void
+update_wx_lines(void)
+{
+    if (NULL == getofp_widget)
+        return;
+
+    for (int i = 0; i < N_WX_LINES; i++) {
+        char line[250];
+        if (i < wx_info.n_wx)
+            snprintf(line, sizeof(line), "%s: %s", wx_info.wx[i].station, wx_info.wx[i].text);
+        else
+            line[0] = '\0';
+        XPSetWidgetDescriptor(wx_line[i], line);
+    }
+}
+
 static void
 create_widget()
 {
@@ -326,7 +950,7 @@ create_widget()
     int left = 200;
     int top = 800;
     int width = 450;
-    int height = 300;
+    int height = 280 + N_WX_LINES * 15;
 
     getofp_widget_ctx.l = left;
     getofp_widget_ctx.t = top;
@@ -351,9 +975,9 @@ create_widget()
                               1, "", 0, getofp_widget, xpWidgetClass_Caption);
 
     top -= 20;
-    display_widget = XPCreateCustomWidget(left + 10, top, left + width -20, top - height + 10,
+    display_widget = XPCreateCustomWidget(left + 10, top, left + width -20, top - DISPLAY_HEIGHT,
                                            1, "", 0, getofp_widget, getofp_widget_cb);
-    top -= 50;
+    top -= DISPLAY_HEIGHT + 10;
     left1 = left + 10;
     xfer_fuel_btn = XPCreateWidget(left1, top, left1 + 50, top - 30,
                               1, "Refuel", 0, getofp_widget, xpWidgetClass_Button);
@@ -368,10 +992,37 @@ create_widget()
     xfer_all_btn = XPCreateWidget(left1, top, left1 + 150, top - 30,
                               1, "Xfer Load data to ISCS", 0, getofp_widget, xpWidgetClass_Button);
     XPAddWidgetCallback(xfer_all_btn, getofp_widget_cb);
+
+    top -= 40;
+    for (int i = 0; i < N_WX_LINES; i++) {
+        wx_line[i] = XPCreateWidget(left + 10, top, left + width - 10, top - 15,
+                                    1, "", 0, getofp_widget, xpWidgetClass_Caption);
+        top -= 15;
+    }
+
+    update_wx_lines();
 }
 
+/* run an OFP xml pasted to the clipboard through the pipeline */
 static void
-menu_cb(void *menu_ref, void *item_ref)
+import_clipboard(void)
+{
+    create_widget();
+    show_widget(&getofp_widget_ctx);
+    start_fetch(0, 0, NULL, XML_CLIPBOARD, 0);
+}
+
+/* run the archived OFP before the one on display through the pipeline, repeat to go further back */
+static void
+load_previous(void)
+{
+    create_widget();
+    show_widget(&getofp_widget_ctx);
+    start_fetch(0, 0, NULL, 0, hist_shown ? hist_shown : UINT64_MAX);
+}
+
+static void
+menu_select(void *menu_ref, void *item_ref)
 {
     /* create gui */
     if (item_ref == &getofp_widget) {
@@ -380,6 +1031,16 @@ menu_cb(void *menu_ref, void *item_ref)
         return;
     }
 
+    if (item_ref == &import_ref) {
+        import_clipboard();
+        return;
+    }
+
+    if (item_ref == &hist_ref) {
+        load_previous();
+        return;
+    }
+
     if (item_ref == &conf_widget) {
         if (NULL == conf_widget) {
             int left = 250;
@@ -440,9 +1101,17 @@ menu_cb(void *menu_ref, void *item_ref)
     }
 }
 
+static void
+menu_cb(void *menu_ref, void *item_ref)
+{
+    double t0 = tlasxp_prof_begin();
+    menu_select(menu_ref, item_ref);
+    tlasxp_prof_end(PROF_MENU, t0);
+}
+
 /* call back for fetch cmd */
 static int
-fetch_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+fetch_cmd(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
 {
     UNUSED(ref);
     if (xplm_CommandBegin != phase)
@@ -450,14 +1119,23 @@ fetch_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
 
     log_msg("fetch cmd called");
     create_widget();
-    fetch_ofp();
+    start_fetch(0, 0, NULL, 0, 0);
     show_widget(&getofp_widget_ctx);
     return 0;
 }
 
+static int
+fetch_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    double t0 = tlasxp_prof_begin();
+    int res = fetch_cmd(cmdr, phase, ref);
+    tlasxp_prof_end(PROF_CMD, t0);
+    return res;
+}
+
 /* call back for fetch_xfer cmd */
 static int
-fetch_xfer_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+fetch_xfer_cmd(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
 {
     UNUSED(ref);
     if (xplm_CommandBegin != phase)
@@ -465,18 +1143,66 @@ fetch_xfer_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
 
     log_msg("fetch_xfer cmd called");
 
-    if (0 == fetch_ofp()) {
-        /* error, show widget */
-        create_widget();
-        show_widget(&getofp_widget_ctx);
+    /* on error the widget is shown when the fetch completes */
+    start_fetch(1, 1, NULL, 0, 0);
+    return 0;
+}
+
+static int
+fetch_xfer_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    double t0 = tlasxp_prof_begin();
+    int res = fetch_xfer_cmd(cmdr, phase, ref);
+    tlasxp_prof_end(PROF_CMD, t0);
+    return res;
+}
+
+/* call back for import_clipboard cmd */
+static int
+import_clipboard_cmd(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    UNUSED(ref);
+    if (xplm_CommandBegin != phase)
         return 0;
-    }
+
+    log_msg("import_clipboard cmd called");
+    import_clipboard();
+    return 0;
+}
+
+static int
+import_clipboard_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    double t0 = tlasxp_prof_begin();
+    int res = import_clipboard_cmd(cmdr, phase, ref);
+    tlasxp_prof_end(PROF_CMD, t0);
+    return res;
+}
+
+static int
+load_previous_cmd(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    UNUSED(ref);
+    if (xplm_CommandBegin != phase)
+        return 0;
+
+    log_msg("load_previous cmd called");
+    load_previous();
     return 0;
 }
 
+static int
+load_previous_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    double t0 = tlasxp_prof_begin();
+    int res = load_previous_cmd(cmdr, phase, ref);
+    tlasxp_prof_end(PROF_CMD, t0);
+    return res;
+}
+
 /* call back for toggle cmd */
 static int
-toggle_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+toggle_cmd(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
 {
     UNUSED(ref);
     if (xplm_CommandBegin != phase)
@@ -494,11 +1220,20 @@ toggle_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
     return 0;
 }
 
+static int
+toggle_cmd_cb(XPLMCommandRef cmdr, XPLMCommandPhase phase, void *ref)
+{
+    double t0 = tlasxp_prof_begin();
+    int res = toggle_cmd(cmdr, phase, ref);
+    tlasxp_prof_end(PROF_CMD, t0);
+    return res;
+}
+
 static int aoc_init_done;
 
 /* flight loop for delayed actions */
 static float
-flight_loop_cb(float unused1, float unused2, int unused3, void *unused4)
+flight_loop(float unused1, float unused2, int unused3, void *unused4)
 {
     if (aoc_init_done)
         return 0;
@@ -523,18 +1258,192 @@ flight_loop_cb(float unused1, float unused2, int unused3, void *unused4)
 
     if (aoc_init_done) {
         log_msg("AOC init detected");
-        fetch_ofp();
+        start_fetch(0, 0, NULL, 0, 0);
         return 0;
     }
 
     return 2.0;
 }
 
+static float
+flight_loop_cb(float unused1, float unused2, int unused3, void *unused4)
+{
+    double t0 = tlasxp_prof_begin();
+    float res = flight_loop(unused1, unused2, unused3, unused4);
+    tlasxp_prof_end(PROF_FLIGHT_LOOP, t0);
+    return res;
+}
+
+/* flight loop that collects the result of the fetch worker */
+static float
+fetch_poll(float unused1, float unused2, int unused3, void *unused4)
+{
+    if (! fetch_running)
+        return 0;
+
+    if (! __atomic_load_n(&fetch_finished, __ATOMIC_ACQUIRE))
+        return -1.0;
+
+    join_fetch();
+
+    if (fetch_rc.canceled) {
+        log_msg("fetch was canceled, result discarded");
+        return 0;
+    }
+
+    /* the worker is gone, fetch_ofp_info and the messages are ours now */
+    if (fetch_no_input) {
+        if (status_line)
+            XPSetWidgetDescriptor(status_line, fetch_ofp_info.status);
+        return 0;
+    }
+
+    strcpy(msg_line_1, fetch_msg_1);
+    strcpy(msg_line_2, fetch_msg_2);
+    strcpy(msg_line_3, fetch_msg_3);
+    display_dirty = 1;
+
+    if (! tlasxp_snap_publish(&fetch_ofp_info))
+        return 0;
+
+    if (fetch_ofp_info.valid)
+        hist_shown = fetch_hist_seq;
+
+    /* the worker may have renewed expired reports without any WX_CHANGES */
+    wx_info = fetch_wx_info;
+    display_dirty = 1;
+    update_wx_lines();
+
+    if (status_line)
+        XPSetWidgetDescriptor(status_line, fetch_ofp_info.status);
+
+    /* consumers of the message only see an OFP that actually changed */
+    if (fetch_ofp_info.valid) {
+        if (fetch_changes) {
+            tlasxp_dr_publish();
+            if (! fetch_imported)
+                tlasxp_prefetch_ofp(&fetch_ofp_info);
+        }
+
+        if (fetch_xfer)
+            xfer_load_data(XFER_FUEL | XFER_PAYLOAD);
+    }
+
+    if (! fetch_ofp_info.valid && fetch_show_on_error) {
+        create_widget();
+        show_widget(&getofp_widget_ctx);
+    }
+
+    return 0;
+}
+
+static float
+fetch_poll_cb(float unused1, float unused2, int unused3, void *unused4)
+{
+    double t0 = tlasxp_prof_begin();
+    float res = fetch_poll(unused1, unused2, unused3, unused4);
+    tlasxp_prof_end(PROF_FETCH_POLL, t0);
+    return res;
+}
+
+/* hand OFPs from the drop folder to the pipeline, it's just an atomic load if there is none */
+static float
+import_loop(float unused1, float unused2, int unused3, void *unused4)
+{
+    int len;
+    char *xml = tlasxp_import_take(&len);
+    if (xml) {
+        log_msg("OFP imported from drop folder");
+        start_fetch(1, 0, xml, len, 0);
+    }
+
+    return -1.0;
+}
+
+static float
+import_loop_cb(float unused1, float unused2, int unused3, void *unused4)
+{
+    double t0 = tlasxp_prof_begin();
+    float res = import_loop(unused1, unused2, unused3, unused4);
+    tlasxp_prof_end(PROF_IMPORT, t0);
+    return res;
+}
+
+/*
+ * The plugin loads with every aircraft but is useful for a ToLiss only. So
+ * everything with threads, sockets, caches or file I/O is started on the first
+ * detection of a ToLiss and torn down when another aircraft loads or the plugin
+ * is disabled. Other sessions pay for the registration in XPluginStart only.
+ */
+static void
+subsys_start(void)
+{
+    if (subsys_up)
+        return;
+
+    double t0 = tlasxp_now();
+
+    /* before any thread does http */
+    tlasxp_http_init();
+
+    char fn[600];
+    snprintf(fn, sizeof(fn), "%s%sOutput%stlasxp_history", xpdir, psep, psep);
+    tlasxp_hist_init(fn);
+
+    snprintf(fn, sizeof(fn), "%s%sOutput%stlasxp_latency.dat", xpdir, psep, psep);
+    tlasxp_latency_init(fn);
+
+    tlasxp_asxp_start();
+    tlasxp_prefetch_start(cache_path, PREFETCH_BUDGET);
+    tlasxp_httpd_start(httpd_port);
+
+    if (import_dir[0])
+        tlasxp_import_start(import_dir);
+    else {
+        snprintf(fn, sizeof(fn), "%s%sOutput%stlasxp_import%s", xpdir, psep, psep, psep);
+        tlasxp_import_start(fn);
+    }
+
+    if (NULL == import_loop_id)
+        import_loop_id = XPLMCreateFlightLoop(&create_import_loop);
+    XPLMScheduleFlightLoop(import_loop_id, -1.0, 1);
+
+    subsys_up = 1;
+    log_msg("subsystems started in %0.1f ms", (tlasxp_now() - t0) * 1000.0);
+}
+
+static void
+subsys_stop(const char *reason)
+{
+    if (! subsys_up)
+        return;
+
+    double t0 = tlasxp_now();
+
+    /* no thread must survive */
+    cancel_fetch(reason);
+    join_fetch();
+    tlasxp_import_stop();
+    if (import_loop_id)
+        XPLMScheduleFlightLoop(import_loop_id, 0.0, 0);
+    tlasxp_asxp_stop();
+    tlasxp_prefetch_stop();
+    tlasxp_httpd_stop();
+    tlasxp_httpd_publish(NULL, NULL);
+    tlasxp_sidecar_close();
+    tlasxp_latency_save();
+    tlasxp_http_cleanup();      /* all threads are gone now */
+
+    subsys_up = 0;
+    log_msg("subsystems stopped (%s) in %0.1f ms", reason, (tlasxp_now() - t0) * 1000.0);
+}
+
 //* ------------------------------------------------------ API -------------------------------------------- */
 PLUGIN_API int
 XPluginStart(char *out_name, char *out_sig, char *out_desc)
 {
     log_msg("startup " VERSION);
+    double t0 = tlasxp_now();
 
     /* Always use Unix-native paths on the Mac! */
     XPLMEnableFeature("XPLM_USE_NATIVE_PATHS", 1);
@@ -551,6 +1460,8 @@ XPluginStart(char *out_name, char *out_sig, char *out_desc)
 
     snprintf(tlasxp_tmp_fn, sizeof(tlasxp_tmp_fn), "%s%sOutput%stlasxp_download.tmp",
              xpdir, psep, psep);
+    snprintf(cache_path, sizeof(cache_path), "%s%sOutput%stlasxp_cache%s",
+             xpdir, psep, psep, psep);
 
     /* map standard datarefs, acf datarefs are delayed */
     vr_enabled_dr = XPLMFindDataRef("sim/graphics/VR/enabled");
@@ -562,6 +1473,10 @@ XPluginStart(char *out_name, char *out_sig, char *out_desc)
     strcat(pref_path, psep);
     strcat(pref_path, "toliss_asxp.prf");
     load_pref();
+
+    tlasxp_dr_init();
+    tlasxp_prof_init();
+    log_msg("startup done in %0.1f ms", (tlasxp_now() - t0) * 1000.0);
     return 1;
 }
 
@@ -569,12 +1484,19 @@ XPluginStart(char *out_name, char *out_sig, char *out_desc)
 PLUGIN_API void
 XPluginStop(void)
 {
+    /* no thread must survive the unload of the plugin */
+    subsys_stop("plugin stop");
+    tlasxp_prof_cleanup();
+    tlasxp_dr_cleanup();
+    tlasxp_snap_cleanup();
 }
 
 
 PLUGIN_API void
 XPluginDisable(void)
 {
+    subsys_stop("plugin disable");
+
     if (flight_loop_id)
         XPLMScheduleFlightLoop(flight_loop_id, 0.0, 0);
 }
@@ -585,12 +1507,16 @@ XPluginEnable(void)
 {
     if (flight_loop_id)
         XPLMScheduleFlightLoop(flight_loop_id, 0.0, 0);
+
+    if (toliss_loaded)
+        subsys_start();
+
     return 1;
 }
 
 
-PLUGIN_API void
-XPluginReceiveMessage(XPLMPluginID in_from, long in_msg, void *in_param)
+static void
+receive_message(XPLMPluginID in_from, long in_msg, void *in_param)
 {
     UNUSED(in_from);
 
@@ -620,6 +1546,8 @@ XPluginReceiveMessage(XPLMPluginID in_from, long in_msg, void *in_param)
                     int l = XPLMGetDatab(acf_icao_dr, acf_icao, 0, sizeof(acf_icao) - 1);
                     acf_icao[l] = '\0';
                     log_msg("ToLiss ICAO is %d, %s", l, acf_icao);
+                    toliss_loaded = 1;
+                    subsys_start();
 
                     if (NULL == tlasxp_menu) {
                         XPLMMenuID menu = XPLMFindPluginsMenu();
@@ -627,6 +1555,8 @@ XPluginReceiveMessage(XPLMPluginID in_from, long in_msg, void *in_param)
                         tlasxp_menu = XPLMCreateMenu("ASXP Connector", menu, sub_menu, menu_cb, NULL);
                         XPLMAppendMenuItem(tlasxp_menu, "Configure", &conf_widget, 0);
                         XPLMAppendMenuItem(tlasxp_menu, "Show widget", &getofp_widget, 0);
+                        XPLMAppendMenuItem(tlasxp_menu, "Import OFP from clipboard", &import_ref, 0);
+                        XPLMAppendMenuItem(tlasxp_menu, "Load previous OFP from history", &hist_ref, 0);
 
                         XPLMCommandRef cmdr = XPLMCreateCommand("tlasxp/toggle", "Toggle ASXP connector widget");
                         XPLMRegisterCommandHandler(cmdr, toggle_cmd_cb, 0, NULL);
@@ -637,10 +1567,18 @@ XPluginReceiveMessage(XPLMPluginID in_from, long in_msg, void *in_param)
                         cmdr = XPLMCreateCommand("tlasxp/fetch_xfer", "Fetch ofp data and xfer load data");
                         XPLMRegisterCommandHandler(cmdr, fetch_xfer_cmd_cb, 0, NULL);
 
+                        cmdr = XPLMCreateCommand("tlasxp/import_clipboard", "Import ofp data from the clipboard");
+                        XPLMRegisterCommandHandler(cmdr, import_clipboard_cmd_cb, 0, NULL);
+
+                        cmdr = XPLMCreateCommand("tlasxp/load_previous", "Load the previous ofp from the history");
+                        XPLMRegisterCommandHandler(cmdr, load_previous_cmd_cb, 0, NULL);
+
                         flight_loop_id = XPLMCreateFlightLoop(&create_flight_loop);
                         XPLMScheduleFlightLoop(flight_loop_id, 10.0, 1);
                     }
                } else {
+                   toliss_loaded = 0;
+                   subsys_stop("non ToLiss aircraft loaded");
                    if (flight_loop_id)
                         XPLMScheduleFlightLoop(flight_loop_id, 0.0, 0);
                }
@@ -648,3 +1586,12 @@ XPluginReceiveMessage(XPLMPluginID in_from, long in_msg, void *in_param)
         break;
     }
 }
+
+
+PLUGIN_API void
+XPluginReceiveMessage(XPLMPluginID in_from, long in_msg, void *in_param)
+{
+    double t0 = tlasxp_prof_begin();
+    receive_message(in_from, in_msg, in_param);
+    tlasxp_prof_end(PROF_MESSAGE, t0);
+}
@@ -24,6 +24,55 @@ SOFTWARE.
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+
+#define MAX_NAVLOG 400
+#define MAX_IMPORT_SIZE (4 * 1024 * 1024)    /* of an imported OFP xml */
+
+typedef struct _navlog_fix
+{
+    char ident[8];
+    char type[6];       /* apt, wpt, vor, ndb, ltlg ... */
+    float lat, lon;
+    int altitude;       /* ft */
+    int distance;       /* nm along the route */
+} navlog_fix_t;
+
+#define WIND_MAX_ROWS 128
+#define WIND_MAX_LEVELS 8
+
+/* winds and temperatures aloft of the navlog, quantized */
+typedef struct _wind_cell
+{
+    uint8_t dir;        /* 2° */
+    uint8_t spd;        /* 2 kt */
+    int8_t oat;         /* °C */
+} wind_cell_t;
+
+/* rows are positions along the route, a row's cells are the levels */
+typedef struct _wind_grid
+{
+    uint16_t n_rows, n_levels;
+    uint16_t dist[WIND_MAX_ROWS];       /* nm along the route, ascending */
+    uint16_t level[WIND_MAX_LEVELS];    /* 100 ft, ascending */
+    wind_cell_t cell[WIND_MAX_ROWS * WIND_MAX_LEVELS];  /* [row * n_levels + level] */
+} wind_grid_t;
+
+/* one level of a fix's wind_data as parsed */
+typedef struct _wind_level
+{
+    int altitude;       /* ft */
+    int dir, spd, oat;
+} wind_level_t;
+
+#define MAX_ASSETS 32
+
+/* further downloads of an OFP: PDF, other FMS formats, maps */
+typedef struct _ofp_asset
+{
+    char name[40];
+    char url[300];
+} ofp_asset_t;
 
 typedef struct _ofp_info
 {
@@ -48,13 +97,294 @@ typedef struct _ofp_info
     char sb_fms_link[80];
     char time_generated[11];
     char est_time_enroute[11];
+    char fuel_plan_ramp[10];
+    char pax_count[10];
+    char pax_weight[10];
+    char payload[10];
+    char est_zfw[10];
+    char airac[6];
+    float origin_lat, origin_lon;   /* airport reference points */
+    float destination_lat, destination_lon;
+    int origin_elev, destination_elev;      /* ft */
+    int n_assets;
+    ofp_asset_t assets[MAX_ASSETS];
+    wind_grid_t wind;
+    int fms_source;         /* FMS_SRC_* of the .fms plan, 0 = the FMS stage failed */
+    uint32_t snap_gen;      /* set by tlasxp_snap_publish, unique per publish */
+    int n_navlog;           /* navlog must be last, see tlasxp_hist.c */
+    navlog_fix_t navlog[MAX_NAVLOG];
 } ofp_info_t;
 
+/* field groups reported by tlasxp_ofp_diff() */
+#define OFP_CHG_FLIGHT   0x001
+#define OFP_CHG_AIRPORTS 0x002
+#define OFP_CHG_RWY      0x004
+#define OFP_CHG_ALTN     0x008
+#define OFP_CHG_ROUTE    0x010     /* route or navlog fixes */
+#define OFP_CHG_CRZ      0x020     /* cruise altitude, winds, temperature */
+#define OFP_CHG_FUEL     0x040
+#define OFP_CHG_WEIGHTS  0x080
+#define OFP_CHG_TIMES    0x100
+#define OFP_CHG_ALL      0x1ff
+
+#define FMS_SRC_SIMBRIEF 1      /* downloaded */
+#define FMS_SRC_IMPORT 2        /* generated from an imported navlog */
+
+#define MAX_WX 12
+
+/* weather reports from ASXP along the route */
+typedef struct _wx_info
+{
+    int n_wx;
+    int64_t slot;           /* wx cache time slot the reports are from */
+    struct {
+        char station[8];    /* airport or navlog fix */
+        char text[200];     /* METAR or conditions at the fix */
+    } wx[MAX_WX];
+} wx_info_t;
+
+/* sent to all plugins when a new OFP is available, param is a const ofp_info_t * */
+#define TLASXP_MSG_OFP_READY 0x54415801
+
+/*
+ * optional out of process fetch daemon tlasxpd, POSIX only
+ * Socket and shared memory are per user, see tlasxp_sidecar_names().
+ */
+#define SIDECAR_SLOTS 8
+#define SIDECAR_MAGIC 0x54534331    /* "TSC1" */
+#define SIDECAR_VERSION 1
+
+/* shared memory slot, the daemon writes, plugins read under the seqlock */
+typedef struct _sidecar_slot
+{
+    volatile uint32_t seq;      /* odd while being written */
+    uint32_t ofp_size;          /* sizeof(ofp_info_t) of the writer */
+    char pilot_id[20];
+    ofp_info_t ofp_info;
+} sidecar_slot_t;
+
+/* the whole segment, readers check the header before touching a slot */
+typedef struct _sidecar_shm
+{
+    volatile uint32_t magic;    /* set last by the daemon */
+    uint32_t version;
+    uint32_t slot_size;         /* sizeof(sidecar_slot_t) of the writer */
+    uint32_t n_slots;
+    sidecar_slot_t slots[SIDECAR_SLOTS];
+} sidecar_shm_t;
+
+/* control block of a pipeline run: one overall deadline + async cancelation */
+typedef struct _run_ctl
+{
+    volatile int canceled;  /* set by any thread to abort the run */
+    double deadline;        /* absolute, tlasxp_now() timebase */
+    double first_byte;      /* time the first response byte arrived, set by the http backend */
+    double first_byte_deadline; /* abort if there is no first byte by then, 0: none */
+    struct _run_ctl *parent;    /* a canceled parent aborts the child as well */
+} run_ctl_t;
+
+/* a blocking transfer that tlasxp_run_cancel() interrupts by calling wake(ref) */
+typedef struct _run_wake
+{
+    run_ctl_t *rc;
+    void (*wake)(void *ref);
+    void *ref;
+    int fired;              /* wake() was called */
+    struct _run_wake *next;
+} run_wake_t;
+
+/* retry + hedging policy for idempotent GETs */
+typedef struct _retry_policy
+{
+    int max_attempts;
+    double backoff_base;    /* s, doubled with each retry, full jitter */
+    double backoff_cap;     /* s */
+    double hedge_delay;     /* s, <= 0 disables hedging */
+} retry_policy_t;
+
+/* persistent, kept alive connection to one host, not thread safe */
+typedef struct _http_conn http_conn_t;
+typedef struct _native_conn native_conn_t;  /* of the HTTP backend */
+typedef struct _http_tap http_tap_t;        /* recorder of an exchange */
+
+#define ASXP_URL "http://localhost:19285"
+
+/* endpoint classes for the latency histograms, by host and path */
+enum { LAT_SB_API, LAT_SB_FMS, LAT_SB_ASSET, LAT_ASXP_PROBE, LAT_ASXP_WX, LAT_ASXP_LOAD,
+       LAT_OTHER, LAT_N_EP };
+
+/* timeouts derived from the latency histograms */
+typedef struct _latency_policy
+{
+    double margin;          /* timeout = margin * p99 */
+    double ttfb_floor, ttfb_ceil;
+    double total_floor, total_ceil;
+} latency_policy_t;
+
+/* ASXP state as seen by the health probe */
+typedef enum { ASXP_UNKNOWN, ASXP_UP, ASXP_DOWN } asxp_state_t;
+
+typedef struct _http_stats
+{
+    int requests;
+    int retries;
+    int hedges;
+    int hedge_wins;
+    int failures;
+} http_stats_t;
+
+/* read only memory mapping of a whole file */
+typedef struct _mapped_file
+{
+    void *data;
+    size_t len;
+} mapped_file_t;
+
+/* index entry of the OFP history archive */
+typedef struct _hist_entry
+{
+    uint64_t seq;
+    uint64_t hash;          /* of the uncompressed record */
+    uint32_t ofs, len;      /* of the compressed record in the data file */
+    char time_generated[11];
+    char icao_airline[6];
+    char flight_number[10];
+    char origin[10];
+    char destination[10];
+} hist_entry_t;
+
+#define HIST_MAX_ENTRIES 256
+
+/* per fetch arena allocator */
+typedef struct _arena_block arena_block_t;
+
+typedef struct _arena
+{
+    arena_block_t *blocks;
+    size_t size;        /* of all blocks */
+    size_t cap;
+} arena_t;
+
+typedef struct _arena_stats
+{
+    int allocs;
+    int fallbacks;      /* refused requests, the caller did without */
+    int64_t bytes;      /* total allocated */
+    int64_t high_water; /* of bytes held by all arenas */
+} arena_stats_t;
+
+/* probes of the frame cost profiler, one per kind of XP callback */
+enum { PROF_FLIGHT_LOOP, PROF_FETCH_POLL, PROF_XFER_LOOP, PROF_GETOFP_WIDGET,
+       PROF_CONF_WIDGET, PROF_SHOW_WIDGET, PROF_MENU, PROF_CMD, PROF_MESSAGE,
+       PROF_IMPORT, PROF_N_PROBE };
+
 /* tmpfile is unreliable on windows so we use this as filename */
 extern char tlasxp_tmp_fn[];
 
-extern int tlasxp_http_get(const char *url, FILE *f, int *retlen, int timeout);
+extern uint64_t tlasxp_hash(const void *data, size_t len, uint64_t hash);
+extern int tlasxp_file_hash(const char *fn, uint64_t *hash);
+extern int tlasxp_replace_file(const char *src, const char *dst);
+extern int tlasxp_map_file(const char *fn, mapped_file_t *mf);
+extern void tlasxp_unmap_file(mapped_file_t *mf);
+
+extern void tlasxp_hist_init(const char *base);
+extern int tlasxp_hist_append(const ofp_info_t *ofp_info, arena_t *arena);
+extern int tlasxp_hist_list(hist_entry_t *entries, int max);
+extern int tlasxp_hist_load(uint64_t seq, ofp_info_t *ofp_info);
+
+extern double tlasxp_now(void);
+extern void tlasxp_run_init(run_ctl_t *rc, double budget);
+extern void tlasxp_run_init_child(run_ctl_t *rc, run_ctl_t *parent, double budget);
+extern double tlasxp_run_end(run_ctl_t *rc);
+extern void tlasxp_run_rearm(run_ctl_t *rc, double budget);
+extern void tlasxp_run_cancel(run_ctl_t *rc);
+extern void tlasxp_run_wake_add(run_wake_t *w, run_ctl_t *rc, void (*wake)(void *), void *ref);
+extern int tlasxp_run_wake_remove(run_wake_t *w);
+extern int tlasxp_run_aborted(run_ctl_t *rc);
+extern void tlasxp_run_first_byte(run_ctl_t *rc);
+extern double tlasxp_stage_timeout(run_ctl_t *rc, double share, double cap);
+extern int tlasxp_run_sleep(run_ctl_t *rc, double t);
+
+extern retry_policy_t tlasxp_retry_policy;
+extern http_stats_t tlasxp_http_stats;
+
+extern int tlasxp_http_init(void);
+extern void tlasxp_http_cleanup(void);
+extern int tlasxp_http_get(const char *url, FILE *f, int *retlen, run_ctl_t *rc, double timeout);
+extern int tlasxp_http_get_retry(const char *url, FILE *f, int *retlen, run_ctl_t *rc, double timeout);
+extern void tlasxp_http_log_stats(void);
+
+extern latency_policy_t tlasxp_latency_policy[];
+extern int tlasxp_latency_ep(const char *url);
+extern void tlasxp_latency_add(int ep, double ttfb, double total, int timed_out);
+extern double tlasxp_latency_timeout(int ep, double timeout, double *ttfb_timeout);
+extern void tlasxp_latency_init(const char *fn);
+extern void tlasxp_latency_save(void);
+extern void tlasxp_latency_log(void);
+
+extern size_t tlasxp_arena_cap;
+extern arena_stats_t tlasxp_arena_stats;
+extern void tlasxp_arena_init(arena_t *a, size_t cap);
+extern void *tlasxp_arena_alloc(arena_t *a, size_t n);
+extern void tlasxp_arena_release(arena_t *a);
+extern void tlasxp_arena_log_stats(void);
+
+extern http_conn_t *tlasxp_http_conn_open(const char *base_url);
+extern int tlasxp_http_conn_get(http_conn_t *conn, const char *path, FILE *f, int *retlen,
+                                run_ctl_t *rc, double timeout);
+extern void tlasxp_http_conn_close(http_conn_t *conn);
+
+/* the native HTTP backend, curl or WinHTTP */
+extern int tlasxp_http_native_init(void);
+extern void tlasxp_http_native_cleanup(void);
+extern int tlasxp_http_native_get(const char *url, FILE *f, int *retlen, run_ctl_t *rc, double timeout,
+                                  http_tap_t *tap);
+extern native_conn_t *tlasxp_http_native_conn_open(const char *base_url);
+extern int tlasxp_http_native_conn_get(native_conn_t *conn, const char *path, FILE *f, int *retlen,
+                                       run_ctl_t *rc, double timeout, http_tap_t *tap);
+extern void tlasxp_http_native_conn_close(native_conn_t *conn);
+extern void tlasxp_http_tap_header(http_tap_t *tap, const char *data, size_t len);
+extern void tlasxp_http_tap_chunk(http_tap_t *tap, const void *data, size_t len);
+
+extern int tlasxp_asxp_start(void);
+extern void tlasxp_asxp_stop(void);
+extern asxp_state_t tlasxp_asxp_state(void);
+extern unsigned tlasxp_asxp_generation(void);
+extern int tlasxp_asxp_upload(const char *fms_name, run_ctl_t *rc);
+extern int tlasxp_sidecar_fetch(const char *pilot_id, ofp_info_t *ofp_info, run_ctl_t *rc);
+extern int tlasxp_sidecar_fms(const char *url, const char *fn, run_ctl_t *rc);
+extern void tlasxp_sidecar_close(void);
+extern void tlasxp_sidecar_names(char *sock_path, int sock_len, char *shm_name, int shm_len);
+extern void tlasxp_dr_init(void);
+extern void tlasxp_dr_cleanup(void);
+extern void tlasxp_dr_publish(void);
+extern const ofp_info_t *tlasxp_snap_acquire(void);
+extern void tlasxp_snap_release(const ofp_info_t *ofp);
+extern int tlasxp_snap_publish(const ofp_info_t *ofp);
+extern void tlasxp_snap_cleanup(void);
+extern void tlasxp_prof_init(void);
+extern void tlasxp_prof_cleanup(void);
+extern double tlasxp_prof_begin(void);
+extern void tlasxp_prof_end(int probe, double t0);
+extern int tlasxp_prefetch_start(const char *dir, size_t budget);
+extern void tlasxp_prefetch_stop(void);
+extern void tlasxp_prefetch_ofp(const ofp_info_t *ofp_info);
+extern void tlasxp_prefetch_hold(int on);
+extern int tlasxp_import_start(const char *dir);
+extern void tlasxp_import_stop(void);
+extern char *tlasxp_import_take(int *len);
+extern int tlasxp_import_fms(const ofp_info_t *oi, const char *fn);
+extern int tlasxp_httpd_start(int port);
+extern void tlasxp_httpd_stop(void);
+extern void tlasxp_httpd_publish(const ofp_info_t *oi, const char *fms_fn);
+extern int tlasxp_wx_prefetch(const ofp_info_t *ofp_info, wx_info_t *wx_info, run_ctl_t *rc, double timeout);
+extern int tlasxp_wx_current(const wx_info_t *wx_info);
 extern void log_msg(const char *fmt, ...);
-extern int tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info);
+extern int tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info, run_ctl_t *rc, arena_t *arena);
+extern int tlasxp_ofp_parse(char *ofp, int ofp_len, ofp_info_t *ofp_info, arena_t *arena);
 extern void tlasxp_dump_ofp_info(ofp_info_t *ofp_info);
+extern void tlasxp_wind_build(wind_grid_t *wg, const int *dist, const wind_level_t *levels,
+                              const int *n_levels, int n_fix);
+extern int tlasxp_wind_at(const wind_grid_t *wg, float dist, float alt, float *dir, float *spd, float *oat);
+extern unsigned tlasxp_ofp_diff(const ofp_info_t *o, const ofp_info_t *n, char *summary, int len);
 extern int get_clipboard(char *buffer, int buflen);
@@ -0,0 +1,126 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Per fetch arena allocator.
+ *
+ * All parse time allocations of a fetch come from an arena that is released
+ * in one step when the fetch is done. A cap on the arena's total size keeps the
+ * peak memory of a fetch inside the X-Plane process predictable.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "tlasxp.h"
+
+#define ARENA_BLOCK (64 * 1024)
+#define ARENA_ALIGN 16
+
+struct _arena_block
+{
+    struct _arena_block *next;
+    size_t size, used;
+    char data[] __attribute__((aligned(ARENA_ALIGN)));
+};
+
+size_t tlasxp_arena_cap = 8 * 1024 * 1024;
+arena_stats_t tlasxp_arena_stats;
+
+/* bytes held by all arenas right now */
+static int64_t arena_bytes_live;
+
+void
+tlasxp_arena_init(arena_t *a, size_t cap)
+{
+    a->blocks = NULL;
+    a->size = 0;
+    a->cap = cap > 0 ? cap : tlasxp_arena_cap;
+}
+
+void *
+tlasxp_arena_alloc(arena_t *a, size_t n)
+{
+    n = (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    arena_block_t *b = a->blocks;
+    if (NULL == b || b->size - b->used < n) {
+        size_t bs = n > ARENA_BLOCK ? n : ARENA_BLOCK;
+        if (a->size + bs > a->cap) {
+            log_msg("arena: request of %d bytes exceeds cap of %d bytes", (int)n, (int)a->cap);
+            __atomic_add_fetch(&tlasxp_arena_stats.fallbacks, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        if (NULL == (b = malloc(sizeof(arena_block_t) + bs))) {
+            log_msg("arena: can't malloc block of %d bytes", (int)bs);
+            __atomic_add_fetch(&tlasxp_arena_stats.fallbacks, 1, __ATOMIC_RELAXED);
+            return NULL;
+        }
+
+        b->size = bs;
+        b->used = 0;
+        b->next = a->blocks;
+        a->blocks = b;
+        a->size += bs;
+
+        int64_t live = __atomic_add_fetch(&arena_bytes_live, bs, __ATOMIC_RELAXED);
+        int64_t hw = __atomic_load_n(&tlasxp_arena_stats.high_water, __ATOMIC_RELAXED);
+        while (live > hw
+               && ! __atomic_compare_exchange_n(&tlasxp_arena_stats.high_water, &hw, live, 0,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+    }
+
+    void *p = b->data + b->used;
+    b->used += n;
+    __atomic_add_fetch(&tlasxp_arena_stats.allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&tlasxp_arena_stats.bytes, n, __ATOMIC_RELAXED);
+    return p;
+}
+
+void
+tlasxp_arena_release(arena_t *a)
+{
+    arena_block_t *b = a->blocks;
+    while (b) {
+        arena_block_t *next = b->next;
+        free(b);
+        b = next;
+    }
+
+    __atomic_sub_fetch(&arena_bytes_live, a->size, __ATOMIC_RELAXED);
+    a->blocks = NULL;
+    a->size = 0;
+}
+
+void
+tlasxp_arena_log_stats(void)
+{
+    log_msg("arena stats: allocs: %d, bytes: %lld, high water: %lld, fallbacks: %d, cap: %d",
+            tlasxp_arena_stats.allocs, (long long)tlasxp_arena_stats.bytes,
+            (long long)tlasxp_arena_stats.high_water, tlasxp_arena_stats.fallbacks,
+            (int)tlasxp_arena_cap);
+}
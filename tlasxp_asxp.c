@@ -0,0 +1,246 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Client for ActiveSky's local API.
+ *
+ * A background thread probes ASXP over a kept alive loopback connection.
+ * While ASXP is down the circuit breaker is open and uploads are deferred
+ * without touching the network. The last deferred flightplan is uploaded
+ * as soon as the probe sees ASXP again.
+ * The mutex guards the state only, no I/O is done while it is held.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define PROBE_PATH "/ActiveSky/API/"        /* any response means ASXP is alive */
+#define PROBE_INTERVAL_UP 10.0
+#define PROBE_INTERVAL_DOWN 2.0
+#define PROBE_TIMEOUT 0.5
+#define UPLOAD_TIMEOUT 2.0
+
+static pthread_t probe_thread;
+static int running;                 /* caller's thread only */
+static http_conn_t *probe_conn;     /* probe thread only */
+static http_conn_t *upload_conn;    /* fetch worker only, there is at most one */
+static run_ctl_t probe_rc;          /* all I/O of the probe thread, canceled by stop */
+
+/* the mutex protects all below */
+static pthread_mutex_t asxp_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t asxp_cond = PTHREAD_COND_INITIALIZER;
+static int stop_req;
+static asxp_state_t state;        /* read unlocked by tlasxp_asxp_state() */
+static unsigned generation;         /* # of times ASXP came up, read unlocked */
+static char pending[200];           /* deferred upload, "" if none */
+
+/* mutex must be held */
+static void
+set_state(asxp_state_t new_state)
+{
+    if (new_state != state)
+        log_msg("ASXP is %s", (ASXP_UP == new_state) ? "up" : "down");
+    if (ASXP_UP == new_state && ASXP_UP != state)
+        __atomic_add_fetch(&generation, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&state, new_state, __ATOMIC_RELAXED);
+}
+
+static int
+load_flightplan(http_conn_t *conn, const char *fms_name, run_ctl_t *rc, double timeout)
+{
+    char path[300];
+    snprintf(path, sizeof(path), "/ActiveSky/API/LoadFlightPlan?FileName=%s", fms_name);
+    log_msg("ASXP '%s'", path);
+    return tlasxp_http_conn_get(conn, path, NULL, NULL, rc, timeout);
+}
+
+static void *
+probe_worker(void *arg)
+{
+    char fms_name[sizeof(pending)];
+
+    pthread_mutex_lock(&asxp_mutex);
+
+    while (! stop_req) {
+        pthread_mutex_unlock(&asxp_mutex);
+        tlasxp_run_rearm(&probe_rc, PROBE_TIMEOUT);
+        int ok = tlasxp_http_conn_get(probe_conn, PROBE_PATH, NULL, NULL, &probe_rc, PROBE_TIMEOUT);
+        pthread_mutex_lock(&asxp_mutex);
+        if (stop_req)
+            break;
+
+        set_state(ok ? ASXP_UP : ASXP_DOWN);
+
+        if (ok && pending[0]) {
+            strcpy(fms_name, pending);
+            pthread_mutex_unlock(&asxp_mutex);
+            tlasxp_run_rearm(&probe_rc, UPLOAD_TIMEOUT);
+            ok = load_flightplan(probe_conn, fms_name, &probe_rc, UPLOAD_TIMEOUT);
+            pthread_mutex_lock(&asxp_mutex);
+            if (stop_req)
+                break;
+
+            if (ok) {
+                log_msg("deferred flightplan '%s' uploaded to ASXP", fms_name);
+                if (0 == strcmp(pending, fms_name))     /* not superseded meanwhile */
+                    pending[0] = '\0';
+            } else {
+                set_state(ASXP_DOWN);
+            }
+        }
+
+        /* a stop or a failed upload wakes us up early */
+        double interval = (ASXP_UP == state) ? PROBE_INTERVAL_UP : PROBE_INTERVAL_DOWN;
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += (time_t)interval;
+        ts.tv_nsec += (long)((interval - (time_t)interval) * 1.0E9);
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000;
+        }
+
+        if (! stop_req)
+            pthread_cond_timedwait(&asxp_cond, &asxp_mutex, &ts);
+    }
+
+    pthread_mutex_unlock(&asxp_mutex);
+    return NULL;
+}
+
+/* return success == 1 */
+int
+tlasxp_asxp_start(void)
+{
+    if (running)
+        return 1;
+
+    if (NULL == (probe_conn = tlasxp_http_conn_open(ASXP_URL))
+        || NULL == (upload_conn = tlasxp_http_conn_open(ASXP_URL))) {
+        log_msg("can't open ASXP connection");
+        goto err;
+    }
+
+    stop_req = 0;
+    state = ASXP_UNKNOWN;
+    pending[0] = '\0';
+    tlasxp_run_init(&probe_rc, PROBE_TIMEOUT);  /* never reinitialized, so a cancel sticks */
+
+    if (pthread_create(&probe_thread, NULL, probe_worker, NULL)) {
+        log_msg("can't create ASXP probe thread");
+        goto err;
+    }
+
+    running = 1;
+    return 1;
+
+  err:
+    tlasxp_http_conn_close(probe_conn);
+    tlasxp_http_conn_close(upload_conn);
+    probe_conn = upload_conn = NULL;
+    return 0;
+}
+
+void
+tlasxp_asxp_stop(void)
+{
+    if (! running)
+        return;
+
+    /* abort in flight I/O, then wake up the probe thread */
+    tlasxp_run_cancel(&probe_rc);
+    pthread_mutex_lock(&asxp_mutex);
+    stop_req = 1;
+    pthread_cond_signal(&asxp_cond);
+    pthread_mutex_unlock(&asxp_mutex);
+
+    pthread_join(probe_thread, NULL);
+    tlasxp_http_conn_close(probe_conn);
+    tlasxp_http_conn_close(upload_conn);
+    probe_conn = upload_conn = NULL;
+    running = 0;
+}
+
+asxp_state_t
+tlasxp_asxp_state(void)
+{
+    return __atomic_load_n(&state, __ATOMIC_RELAXED);
+}
+
+/*
+ * Changes whenever ASXP comes up, i.e. after a restart of ASXP or the client
+ * it may have lost what was uploaded before.
+ */
+unsigned
+tlasxp_asxp_generation(void)
+{
+    return __atomic_load_n(&generation, __ATOMIC_RELAXED);
+}
+
+/*
+ * Upload a flightplan that is in "Output/FMS plans", runs on the fetch worker.
+ * Return 1 if uploaded, 0 if deferred until ASXP is up again.
+ */
+int
+tlasxp_asxp_upload(const char *fms_name, run_ctl_t *rc)
+{
+    if (! running) {
+        log_msg("ASXP client not running, '%s' not uploaded", fms_name);
+        return 0;
+    }
+
+    pthread_mutex_lock(&asxp_mutex);
+    int down = (ASXP_DOWN == state);
+    if (down)
+        snprintf(pending, sizeof(pending), "%s", fms_name);
+    pthread_mutex_unlock(&asxp_mutex);
+
+    if (down) {
+        /* breaker is open */
+        log_msg("ASXP is down, upload of '%s' deferred", fms_name);
+        return 0;
+    }
+
+    run_ctl_t urc;
+    tlasxp_run_init_child(&urc, rc, UPLOAD_TIMEOUT);
+    int res = load_flightplan(upload_conn, fms_name, &urc, UPLOAD_TIMEOUT);
+
+    pthread_mutex_lock(&asxp_mutex);
+    if (res) {
+        pending[0] = '\0';
+        set_state(ASXP_UP);
+    } else if (! tlasxp_run_aborted(rc)) {
+        set_state(ASXP_DOWN);
+        snprintf(pending, sizeof(pending), "%s", fms_name);
+        pthread_cond_signal(&asxp_cond);    /* reprobe at the short interval */
+    }
+    pthread_mutex_unlock(&asxp_mutex);
+
+    return res;
+}
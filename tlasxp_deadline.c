@@ -0,0 +1,227 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#include "tlasxp.h"
+
+/* monotonic time in seconds */
+double
+tlasxp_now(void)
+{
+#ifdef WINDOWS
+    static double tick;
+    LARGE_INTEGER c;
+
+    if (0.0 == tick) {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        tick = 1.0 / (double)f.QuadPart;
+    }
+
+    QueryPerformanceCounter(&c);
+    return (double)c.QuadPart * tick;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1.0E-9 * ts.tv_nsec;
+#endif
+}
+
+void
+tlasxp_run_init(run_ctl_t *rc, double budget)
+{
+    rc->canceled = 0;
+    rc->deadline = tlasxp_now() + budget;
+    rc->first_byte = 0.0;
+    rc->first_byte_deadline = 0.0;
+    rc->parent = NULL;
+}
+
+/* a child never outlives its parent's deadline */
+void
+tlasxp_run_init_child(run_ctl_t *rc, run_ctl_t *parent, double budget)
+{
+    tlasxp_run_init(rc, budget);
+    rc->parent = parent;
+    if (parent && parent->deadline < rc->deadline)
+        rc->deadline = parent->deadline;
+}
+
+/* deadline of the whole run, that of the outermost parent */
+double
+tlasxp_run_end(run_ctl_t *rc)
+{
+    if (NULL == rc)
+        return 1.0E30;
+
+    while (rc->parent)
+        rc = rc->parent;
+    return rc->deadline;
+}
+
+/*
+ * start the next step of a long lived run with a fresh budget, by the run's
+ * owner only. Unlike tlasxp_run_init() a cancel is never lost.
+ */
+void
+tlasxp_run_rearm(run_ctl_t *rc, double budget)
+{
+    double zero = 0.0;
+    rc->deadline = tlasxp_now() + budget;
+    __atomic_store(&rc->first_byte, &zero, __ATOMIC_RELEASE);
+    rc->first_byte_deadline = 0.0;
+}
+
+/* transfers in progress that a cancel must interrupt */
+static pthread_mutex_t wake_mutex = PTHREAD_MUTEX_INITIALIZER;
+static run_wake_t *wake_list;
+
+/*
+ * Register a blocking transfer on rc. A cancel of rc or any of its parents
+ * calls wake(ref) once, under a lock that tlasxp_run_wake_remove() takes as well.
+ */
+void
+tlasxp_run_wake_add(run_wake_t *w, run_ctl_t *rc, void (*wake)(void *), void *ref)
+{
+    w->rc = rc;
+    w->wake = wake;
+    w->ref = ref;
+    w->fired = 0;
+
+    pthread_mutex_lock(&wake_mutex);
+    w->next = wake_list;
+    wake_list = w;
+    pthread_mutex_unlock(&wake_mutex);
+}
+
+/* unregister, return 1 if wake() was called */
+int
+tlasxp_run_wake_remove(run_wake_t *w)
+{
+    pthread_mutex_lock(&wake_mutex);
+    for (run_wake_t **pp = &wake_list; *pp; pp = &(*pp)->next)
+        if (*pp == w) {
+            *pp = w->next;
+            break;
+        }
+    pthread_mutex_unlock(&wake_mutex);
+    return w->fired;
+}
+
+/* may be called from any thread, transfers of the run are interrupted */
+void
+tlasxp_run_cancel(run_ctl_t *rc)
+{
+    __atomic_store_n(&rc->canceled, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&wake_mutex);
+    for (run_wake_t *w = wake_list; w; w = w->next) {
+        if (w->fired)
+            continue;
+
+        for (run_ctl_t *r = w->rc; r; r = r->parent)
+            if (r == rc) {
+                w->fired = 1;
+                w->wake(w->ref);
+                break;
+            }
+    }
+    pthread_mutex_unlock(&wake_mutex);
+}
+
+/* return 1 if the run was canceled or is past its deadline */
+int
+tlasxp_run_aborted(run_ctl_t *rc)
+{
+    if (NULL == rc)
+        return 0;
+
+    double now = tlasxp_now();
+    if (now >= rc->deadline)
+        return 1;
+
+    if (rc->first_byte_deadline > 0.0 && now >= rc->first_byte_deadline) {
+        double first_byte;
+        __atomic_load(&rc->first_byte, &first_byte, __ATOMIC_ACQUIRE);
+        if (0.0 == first_byte)
+            return 1;
+    }
+
+    for (; rc; rc = rc->parent)
+        if (__atomic_load_n(&rc->canceled, __ATOMIC_ACQUIRE))
+            return 1;
+
+    return 0;
+}
+
+/* record the arrival of the first byte in rc and all parents that don't have one yet */
+void
+tlasxp_run_first_byte(run_ctl_t *rc)
+{
+    double now = tlasxp_now();
+
+    for (; rc; rc = rc->parent) {
+        double zero = 0.0;
+        __atomic_compare_exchange(&rc->first_byte, &zero, &now, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+/* sleep t seconds in short slices, return 0 if the run was aborted meanwhile */
+int
+tlasxp_run_sleep(run_ctl_t *rc, double t)
+{
+    double t_end = tlasxp_now() + t;
+
+    while (tlasxp_now() < t_end) {
+        if (tlasxp_run_aborted(rc))
+            return 0;
+        usleep(20 * 1000);
+    }
+
+    return ! tlasxp_run_aborted(rc);
+}
+
+/*
+ * Time budget for the next stage: 'share' of what is left of the run's deadline,
+ * limited to 'cap' seconds. Later stages get what earlier ones did not use.
+ */
+double
+tlasxp_stage_timeout(run_ctl_t *rc, double share, double cap)
+{
+    double left = rc->deadline - tlasxp_now();
+    if (left <= 0.0)
+        return 0.0;
+
+    left *= share;
+    return (left < cap) ? left : cap;
+}
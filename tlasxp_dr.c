@@ -0,0 +1,302 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Publish the parsed OFP to other plugins.
+ *
+ * All datarefs are read only and are materialized only when read.
+ * The accessors read the current OFP snapshot, see tlasxp_snap.c.
+ * On each new OFP a TLASXP_MSG_OFP_READY message is sent to all plugins,
+ * param is a pointer to the immutable snapshot. We hold a reference so it
+ * stays valid until the next but one OFP_READY message.
+ *
+ * Winds aloft: write the position to tlasxp/wind/query_dist (nm along the route)
+ * and query_alt (ft), then read tlasxp/wind/dir, spd, oat. The raw grid is
+ * tlasxp/wind/grid, a wind_grid_t.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "XPLMDataAccess.h"
+#include "XPLMPlugin.h"
+
+#include "tlasxp.h"
+
+#define UNUSED(x) (void)(x)
+
+typedef struct _str_dr
+{
+    const char *name;
+    int ofs;
+    XPLMDataRef dr;
+} str_dr_t;
+
+#define S(field) { "tlasxp/ofp/" #field, offsetof(ofp_info_t, field), NULL }
+static str_dr_t str_dr[] = {
+    S(status), S(units), S(icao_airline), S(flight_number), S(aircraft_icao),
+    S(origin), S(origin_rwy), S(destination), S(destination_rwy), S(alternate),
+    S(altitude), S(tropopause), S(isa_dev), S(wind_component),
+    S(route), S(alt_route), S(time_generated), S(est_time_enroute)
+};
+#undef S
+
+#define N_STR_DR (sizeof(str_dr) / sizeof(str_dr[0]))
+
+static int seqno;
+static const ofp_info_t *snapshot[2];   /* current and previous, referenced */
+
+static XPLMDataRef valid_dr, seqno_dr, n_navlog_dr, ident_dr,
+                   lat_dr, lon_dr, alt_dr, dist_dr;
+
+static XPLMDataRef wind_grid_dr, query_dist_dr, query_alt_dr, wind_dir_dr, wind_spd_dr, wind_oat_dr;
+static float query_dist, query_alt;
+
+/* navlog idents as one blank separated string, built on first read */
+static char *idents;
+static int idents_len;
+static uint32_t idents_gen;     /* snap_gen of the snapshot idents is built from */
+
+static int
+copy_bytes(const char *src, int len, void *out, int ofs, int max)
+{
+    if (NULL == out)
+        return len;
+
+    if (ofs >= len)
+        return 0;
+
+    int n = (len - ofs < max) ? len - ofs : max;
+    memcpy(out, src + ofs, n);
+    return n;
+}
+
+static int
+get_str(void *ref, void *out, int ofs, int max)
+{
+    const str_dr_t *sd = ref;
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+    const char *s = (const char *)ofp + sd->ofs;
+    int n = copy_bytes(s, strlen(s), out, ofs, max);
+    tlasxp_snap_release(ofp);
+    return n;
+}
+
+static int
+get_int(void *ref)
+{
+    if (ref == &seqno_dr)
+        return seqno;
+
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+    int val = (ref == &valid_dr) ? ofp->valid : ofp->n_navlog;
+    tlasxp_snap_release(ofp);
+    return val;
+}
+
+static int
+get_idents(void *ref, void *out, int ofs, int max)
+{
+    UNUSED(ref);
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+
+    /* a failed fetch replaces the snapshot without a new seqno, slots are reused */
+    if (NULL == idents || idents_gen != ofp->snap_gen) {
+        free(idents);
+        idents = malloc(ofp->n_navlog * (sizeof(ofp->navlog[0].ident) + 1) + 1);
+        if (NULL == idents) {
+            tlasxp_snap_release(ofp);
+            return 0;
+        }
+
+        char *s = idents;
+        for (int i = 0; i < ofp->n_navlog; i++)
+            s += sprintf(s, (i > 0) ? " %s" : "%s", ofp->navlog[i].ident);
+
+        idents_len = s - idents;
+        idents_gen = ofp->snap_gen;
+    }
+
+    tlasxp_snap_release(ofp);
+    return copy_bytes(idents, idents_len, out, ofs, max);
+}
+
+static int
+get_wind_grid(void *ref, void *out, int ofs, int max)
+{
+    UNUSED(ref);
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+    int n = copy_bytes((const char *)&ofp->wind, sizeof(ofp->wind), out, ofs, max);
+    tlasxp_snap_release(ofp);
+    return n;
+}
+
+static float
+get_query(void *ref)
+{
+    return *(float *)ref;
+}
+
+static void
+set_query(void *ref, float val)
+{
+    *(float *)ref = val;
+}
+
+static float
+get_wind(void *ref)
+{
+    float dir, spd, oat;
+    const ofp_info_t *ofp = tlasxp_snap_acquire();
+    int ok = tlasxp_wind_at(&ofp->wind, query_dist, query_alt, &dir, &spd, &oat);
+    tlasxp_snap_release(ofp);
+    if (! ok)
+        return 0.0f;
+
+    if (ref == &wind_dir_dr)
+        return dir;
+    if (ref == &wind_spd_dr)
+        return spd;
+    return oat;
+}
+
+#define NAVLOG_ARRAY(name, type, field) \
+static int \
+name(void *ref, type *out, int ofs, int max) \
+{ \
+    UNUSED(ref); \
+    const ofp_info_t *ofp = tlasxp_snap_acquire(); \
+    int n = 0; \
+    if (NULL == out) \
+        n = ofp->n_navlog; \
+    else \
+        for (int i = ofs; i < ofp->n_navlog && n < max; i++) \
+            out[n++] = ofp->navlog[i].field; \
+    tlasxp_snap_release(ofp); \
+    return n; \
+}
+
+NAVLOG_ARRAY(get_lat, float, lat)
+NAVLOG_ARRAY(get_lon, float, lon)
+NAVLOG_ARRAY(get_alt, int, altitude)
+NAVLOG_ARRAY(get_dist, int, distance)
+
+static XPLMDataRef
+reg_int(const char *name, void *ref)
+{
+    return XPLMRegisterDataAccessor(name, xplmType_Int, 0, get_int, NULL,
+                                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                    ref, NULL);
+}
+
+static XPLMDataRef
+reg_float(const char *name, int writable, void *ref)
+{
+    return XPLMRegisterDataAccessor(name, xplmType_Float, writable, NULL, NULL,
+                                    writable ? get_query : get_wind, writable ? set_query : NULL,
+                                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                    ref, writable ? ref : NULL);
+}
+
+static XPLMDataRef
+reg_data(const char *name, XPLMGetDatab_f cb, void *ref)
+{
+    return XPLMRegisterDataAccessor(name, xplmType_Data, 0, NULL, NULL,
+                                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, cb, NULL,
+                                    ref, NULL);
+}
+
+void
+tlasxp_dr_init(void)
+{
+    for (unsigned int i = 0; i < N_STR_DR; i++)
+        str_dr[i].dr = reg_data(str_dr[i].name, get_str, &str_dr[i]);
+
+    valid_dr = reg_int("tlasxp/ofp/valid", &valid_dr);
+    seqno_dr = reg_int("tlasxp/ofp/seqno", &seqno_dr);
+    n_navlog_dr = reg_int("tlasxp/navlog/n", &n_navlog_dr);
+    ident_dr = reg_data("tlasxp/navlog/ident", get_idents, NULL);
+
+    lat_dr = XPLMRegisterDataAccessor("tlasxp/navlog/lat", xplmType_FloatArray, 0,
+                                      NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                      get_lat, NULL, NULL, NULL, NULL, NULL);
+    lon_dr = XPLMRegisterDataAccessor("tlasxp/navlog/lon", xplmType_FloatArray, 0,
+                                      NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                      get_lon, NULL, NULL, NULL, NULL, NULL);
+    alt_dr = XPLMRegisterDataAccessor("tlasxp/navlog/altitude", xplmType_IntArray, 0,
+                                      NULL, NULL, NULL, NULL, NULL, NULL,
+                                      get_alt, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    dist_dr = XPLMRegisterDataAccessor("tlasxp/navlog/distance", xplmType_IntArray, 0,
+                                       NULL, NULL, NULL, NULL, NULL, NULL,
+                                       get_dist, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+
+    wind_grid_dr = reg_data("tlasxp/wind/grid", get_wind_grid, NULL);
+    query_dist_dr = reg_float("tlasxp/wind/query_dist", 1, &query_dist);
+    query_alt_dr = reg_float("tlasxp/wind/query_alt", 1, &query_alt);
+    wind_dir_dr = reg_float("tlasxp/wind/dir", 0, &wind_dir_dr);
+    wind_spd_dr = reg_float("tlasxp/wind/spd", 0, &wind_spd_dr);
+    wind_oat_dr = reg_float("tlasxp/wind/oat", 0, &wind_oat_dr);
+}
+
+void
+tlasxp_dr_cleanup(void)
+{
+    for (unsigned int i = 0; i < N_STR_DR; i++)
+        if (str_dr[i].dr)
+            XPLMUnregisterDataRef(str_dr[i].dr);
+
+    XPLMDataRef *drs[] = { &valid_dr, &seqno_dr, &n_navlog_dr, &ident_dr,
+                           &lat_dr, &lon_dr, &alt_dr, &dist_dr,
+                           &wind_grid_dr, &query_dist_dr, &query_alt_dr,
+                           &wind_dir_dr, &wind_spd_dr, &wind_oat_dr };
+    for (unsigned int i = 0; i < sizeof(drs) / sizeof(drs[0]); i++) {
+        if (*drs[i])
+            XPLMUnregisterDataRef(*drs[i]);
+        *drs[i] = NULL;
+    }
+
+    free(idents);
+    idents = NULL;
+
+    for (int i = 0; i < 2; i++)
+        if (snapshot[i])
+            tlasxp_snap_release(snapshot[i]);
+    snapshot[0] = snapshot[1] = NULL;
+}
+
+/* a new OFP snapshot was published, tell the world */
+void
+tlasxp_dr_publish(void)
+{
+    seqno++;
+
+    const ofp_info_t *snap = tlasxp_snap_acquire();
+    if (snapshot[1])
+        tlasxp_snap_release(snapshot[1]);
+    snapshot[1] = snapshot[0];
+    snapshot[0] = snap;
+
+    XPLMSendMessageToPlugin(XPLM_NO_PLUGIN_ID, TLASXP_MSG_OFP_READY, (void *)snap);
+}
@@ -0,0 +1,157 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "tlasxp.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/* FNV-1a, pass 0 to start a new hash or the previous result to continue */
+uint64_t
+tlasxp_hash(const void *data, size_t len, uint64_t hash)
+{
+    const unsigned char *p = data;
+
+    if (0 == hash)
+        hash = FNV_OFFSET;
+
+    while (len-- > 0) {
+        hash ^= *p++;
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/* return success == 1 */
+int
+tlasxp_file_hash(const char *fn, uint64_t *hash)
+{
+    char buffer[16 * 1024];
+    size_t n;
+
+    FILE *f = fopen(fn, "rb");
+    if (NULL == f)
+        return 0;
+
+    uint64_t h = FNV_OFFSET;
+    while (0 < (n = fread(buffer, 1, sizeof(buffer), f)))
+        h = tlasxp_hash(buffer, n, h);
+
+    int res = ! ferror(f);
+    fclose(f);
+    *hash = h;
+    return res;
+}
+
+/* atomically replace dst by src, both must be on the same filesystem */
+int
+tlasxp_replace_file(const char *src, const char *dst)
+{
+#ifdef WINDOWS
+    return MoveFileExA(src, dst, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return 0 == rename(src, dst);
+#endif
+}
+
+/* map a whole file read only, return success == 1 */
+int
+tlasxp_map_file(const char *fn, mapped_file_t *mf)
+{
+    mf->data = NULL;
+    mf->len = 0;
+
+#ifdef WINDOWS
+    HANDLE h_file = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (INVALID_HANDLE_VALUE == h_file)
+        return 0;
+
+    LARGE_INTEGER size;
+    if (! GetFileSizeEx(h_file, &size) || 0 == size.QuadPart) {
+        CloseHandle(h_file);
+        return 0;
+    }
+
+    HANDLE h_map = CreateFileMappingA(h_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(h_file);        /* the mapping keeps the file open */
+    if (NULL == h_map)
+        return 0;
+
+    mf->data = MapViewOfFile(h_map, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(h_map);         /* the view keeps the mapping */
+    if (NULL == mf->data)
+        return 0;
+
+    mf->len = size.QuadPart;
+#else
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || 0 == st.st_size) {
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p)
+        return 0;
+
+    mf->data = p;
+    mf->len = st.st_size;
+#endif
+    return 1;
+}
+
+void
+tlasxp_unmap_file(mapped_file_t *mf)
+{
+    if (NULL == mf->data)
+        return;
+
+#ifdef WINDOWS
+    UnmapViewOfFile(mf->data);
+#else
+    munmap(mf->data, mf->len);
+#endif
+    mf->data = NULL;
+    mf->len = 0;
+}
@@ -0,0 +1,329 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Local archive of fetched OFPs.
+ *
+ * Parsed OFPs are stored zero run length compressed in a data file that is
+ * used as ring buffer of bounded size. A small fixed size index file describes
+ * the records, oldest first. The data file is written before the index and
+ * the index is replaced atomically so a crash never leaves dangling entries.
+ * Listing and loading work on memory mapped files.
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define HIST_MAGIC 0x54484931      /* "THI1" */
+#define HIST_MAX_BYTES (4 * 1024 * 1024)
+
+typedef struct _hist_index
+{
+    uint32_t magic;
+    uint32_t rec_size;      /* sizeof(ofp_info_t) the records were written with */
+    uint32_t n_entries;
+    uint32_t first;         /* ring index of the oldest entry */
+    uint32_t write_ofs;     /* in the data file */
+    uint32_t pad;
+    uint64_t next_seq;
+    hist_entry_t entries[HIST_MAX_ENTRIES];
+} hist_index_t;
+
+static char idx_fn[600], dat_fn[600];
+static pthread_mutex_t hist_mutex = PTHREAD_MUTEX_INITIALIZER;
+static hist_index_t hist_index;     /* scratch copy for appends */
+
+/*
+ * Compression: the fixed size strings of ofp_info_t are mostly zero padding
+ * so a run of zeros is encoded as 0, count. Anything else is copied.
+ * Worst case output is 2 * len.
+ */
+static int
+compress_zrl(const unsigned char *in, int len, unsigned char *out)
+{
+    int o = 0;
+    for (int i = 0; i < len;) {
+        if (in[i]) {
+            out[o++] = in[i++];
+            continue;
+        }
+
+        int n = 0;
+        while (i < len && 0 == in[i] && n < 255) {
+            i++;
+            n++;
+        }
+
+        out[o++] = 0;
+        out[o++] = n;
+    }
+
+    return o;
+}
+
+/* return the uncompressed length or -1 on corrupted input */
+static int
+expand_zrl(const unsigned char *in, int len, unsigned char *out, int out_len)
+{
+    int o = 0;
+    for (int i = 0; i < len;) {
+        if (in[i]) {
+            if (o >= out_len)
+                return -1;
+            out[o++] = in[i++];
+            continue;
+        }
+
+        if (i + 1 >= len || o + in[i + 1] > out_len)
+            return -1;
+
+        memset(out + o, 0, in[i + 1]);
+        o += in[i + 1];
+        i += 2;
+    }
+
+    return o;
+}
+
+void
+tlasxp_hist_init(const char *base)
+{
+    snprintf(idx_fn, sizeof(idx_fn), "%s.idx", base);
+    snprintf(dat_fn, sizeof(dat_fn), "%s.dat", base);
+}
+
+/* read the current index into hist_index, start a new one if it's missing or incompatible */
+static void
+read_index(void)
+{
+    FILE *f = fopen(idx_fn, "rb");
+    if (f) {
+        int ok = (1 == fread(&hist_index, sizeof(hist_index), 1, f));
+        fclose(f);
+        if (ok && HIST_MAGIC == hist_index.magic && sizeof(ofp_info_t) == hist_index.rec_size)
+            return;
+
+        log_msg("history index '%s' is incompatible, starting a new one", idx_fn);
+    }
+
+    memset(&hist_index, 0, sizeof(hist_index));
+    hist_index.magic = HIST_MAGIC;
+    hist_index.rec_size = sizeof(ofp_info_t);
+    hist_index.next_seq = 1;
+}
+
+static int
+write_index(void)
+{
+    char tmp_fn[610];
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", idx_fn);
+
+    FILE *f = fopen(tmp_fn, "wb");
+    if (NULL == f)
+        return 0;
+
+    int ok = (1 == fwrite(&hist_index, sizeof(hist_index), 1, f));
+    ok &= (0 == fclose(f));
+    if (ok && tlasxp_replace_file(tmp_fn, idx_fn))
+        return 1;
+
+    remove(tmp_fn);
+    return 0;
+}
+
+/* append an OFP to the archive, return success == 1, the buffer comes from the fetch's arena */
+int
+tlasxp_hist_append(const ofp_info_t *ofp_info, arena_t *arena)
+{
+    if (0 == idx_fn[0])
+        return 0;
+
+    int res = 0;
+    FILE *f = NULL;
+
+    /* the unused navlog slots are not archived */
+    int rec_len = offsetof(ofp_info_t, navlog) + ofp_info->n_navlog * sizeof(navlog_fix_t);
+    unsigned char *buf = tlasxp_arena_alloc(arena, 2 * rec_len);
+    if (NULL == buf)
+        goto out;
+
+    int len = compress_zrl((const unsigned char *)ofp_info, rec_len, buf);
+    uint64_t hash = tlasxp_hash(ofp_info, rec_len, 0);
+
+    pthread_mutex_lock(&hist_mutex);
+    read_index();
+    hist_index_t *hi = &hist_index;
+
+    /* a re-fetch of the same plan */
+    if (hi->n_entries > 0
+        && hash == hi->entries[(hi->first + hi->n_entries - 1) % HIST_MAX_ENTRIES].hash) {
+        res = 1;
+        goto unlock;
+    }
+
+    uint32_t ofs = hi->write_ofs;
+    if (ofs + len > HIST_MAX_BYTES)
+        ofs = 0;
+
+    /* evict oldest first until the new record fits */
+    while (hi->n_entries > 0) {
+        int overlap = (HIST_MAX_ENTRIES == hi->n_entries);
+        for (uint32_t i = 0; i < hi->n_entries && ! overlap; i++) {
+            hist_entry_t *e = &hi->entries[(hi->first + i) % HIST_MAX_ENTRIES];
+            overlap = (e->ofs < ofs + len && ofs < e->ofs + e->len);
+        }
+
+        if (! overlap)
+            break;
+
+        hi->first = (hi->first + 1) % HIST_MAX_ENTRIES;
+        hi->n_entries--;
+    }
+
+    if (NULL == (f = fopen(dat_fn, "r+b")) && NULL == (f = fopen(dat_fn, "w+b"))) {
+        log_msg("Can't open history file '%s'", dat_fn);
+        goto unlock;
+    }
+
+    if (fseek(f, ofs, SEEK_SET) || 1 != fwrite(buf, len, 1, f) || fclose(f)) {
+        f = NULL;
+        log_msg("Can't write history file '%s'", dat_fn);
+        goto unlock;
+    }
+    f = NULL;
+
+    hist_entry_t *e = &hi->entries[(hi->first + hi->n_entries) % HIST_MAX_ENTRIES];
+    memset(e, 0, sizeof(*e));
+    e->seq = hi->next_seq++;
+    e->hash = hash;
+    e->ofs = ofs;
+    e->len = len;
+    strcpy(e->time_generated, ofp_info->time_generated);
+    strcpy(e->icao_airline, ofp_info->icao_airline);
+    strcpy(e->flight_number, ofp_info->flight_number);
+    strcpy(e->origin, ofp_info->origin);
+    strcpy(e->destination, ofp_info->destination);
+    hi->n_entries++;
+    hi->write_ofs = ofs + len;
+
+    res = write_index();
+    if (res)
+        log_msg("OFP archived as #%llu, %d -> %d bytes", (unsigned long long)e->seq, rec_len, len);
+    else
+        log_msg("Can't write history index '%s'", idx_fn);
+
+  unlock:
+    if (f) fclose(f);
+    pthread_mutex_unlock(&hist_mutex);
+
+  out:
+    return res;
+}
+
+/* map the index, return NULL if there is none */
+static const hist_index_t *
+map_index(mapped_file_t *mf)
+{
+    if (! tlasxp_map_file(idx_fn, mf))
+        return NULL;
+
+    const hist_index_t *hi = mf->data;
+    if (mf->len < sizeof(hist_index_t) || HIST_MAGIC != hi->magic
+        || sizeof(ofp_info_t) != hi->rec_size) {
+        tlasxp_unmap_file(mf);
+        return NULL;
+    }
+
+    return hi;
+}
+
+/* copy up to max entries newest first, return the number of entries */
+int
+tlasxp_hist_list(hist_entry_t *entries, int max)
+{
+    mapped_file_t mf;
+    int n = 0;
+
+    pthread_mutex_lock(&hist_mutex);
+    const hist_index_t *hi = map_index(&mf);
+    if (hi) {
+        for (int i = hi->n_entries - 1; i >= 0 && n < max; i--)
+            entries[n++] = hi->entries[(hi->first + i) % HIST_MAX_ENTRIES];
+        tlasxp_unmap_file(&mf);
+    }
+
+    pthread_mutex_unlock(&hist_mutex);
+    return n;
+}
+
+/* load the archived OFP with sequence number seq, return success == 1 */
+int
+tlasxp_hist_load(uint64_t seq, ofp_info_t *ofp_info)
+{
+    mapped_file_t mf_idx, mf_dat;
+    int res = 0;
+
+    memset(ofp_info, 0, sizeof(*ofp_info));
+
+    pthread_mutex_lock(&hist_mutex);
+    const hist_index_t *hi = map_index(&mf_idx);
+    if (NULL == hi)
+        goto unlock;
+
+    const hist_entry_t *e = NULL;
+    for (uint32_t i = 0; i < hi->n_entries; i++) {
+        e = &hi->entries[(hi->first + i) % HIST_MAX_ENTRIES];
+        if (e->seq == seq)
+            break;
+        e = NULL;
+    }
+
+    if (e && tlasxp_map_file(dat_fn, &mf_dat)) {
+        if (e->ofs + e->len <= mf_dat.len) {
+            int len = expand_zrl((const unsigned char *)mf_dat.data + e->ofs, e->len,
+                                 (unsigned char *)ofp_info, sizeof(*ofp_info));
+            res = (len > 0 && e->hash == tlasxp_hash(ofp_info, len, 0));
+        }
+
+        tlasxp_unmap_file(&mf_dat);
+    }
+
+    tlasxp_unmap_file(&mf_idx);
+
+  unlock:
+    pthread_mutex_unlock(&hist_mutex);
+
+    if (! res) {
+        log_msg("Can't load OFP #%llu from history", (unsigned long long)seq);
+        memset(ofp_info, 0, sizeof(*ofp_info));
+    }
+
+    return res;
+}
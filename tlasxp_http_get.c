@@ -31,72 +31,108 @@ SOFTWARE.
 
 #include "tlasxp.h"
 
-int tlasxp_http_get(const char *url, FILE *f, int *ret_len, int timeout)
+struct _native_conn
 {
-    DWORD dwSize = 0;
-    DWORD dwDownloaded = 0;
-    BOOL  bResults = FALSE;
-    HINTERNET  hSession = NULL,
-               hConnect = NULL,
-               hRequest = NULL;
+    HINTERNET hSession, hConnect;
+    int secure;
+};
 
-    int result = 0;
-    if (ret_len)
-        *ret_len = 0;
+static HINTERNET
+open_session(void)
+{
+    // Use WinHttpOpen to obtain a session handle.
+    HINTERNET hSession = WinHttpOpen( L"toliss_sb",
+            WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+            WINHTTP_NO_PROXY_NAME,
+            WINHTTP_NO_PROXY_BYPASS, 0 );
+
+    if (NULL == hSession)
+        log_msg("Can't open HTTP session");
+
+    return hSession;
+}
 
+/* crack url into host and path, these must have room for strlen(url) + 1 WCHARs */
+static int
+crack_url(const char *url, WCHAR *host_wc, WCHAR *path_wc, URL_COMPONENTS *urlComp)
+{
     int url_len = strlen(url);
     WCHAR *url_wc = alloca((url_len + 1) * sizeof(WCHAR));
-    WCHAR *host_wc = alloca((url_len + 1) * sizeof(WCHAR));
-    WCHAR *path_wc = alloca((url_len + 1) * sizeof(WCHAR));
 
     mbstowcs_s(NULL, url_wc, url_len + 1, url, _TRUNCATE);
 
-    URL_COMPONENTS urlComp;
-    memset(&urlComp, 0, sizeof(urlComp));
-    urlComp.dwStructSize = sizeof(urlComp);
+    memset(urlComp, 0, sizeof(*urlComp));
+    urlComp->dwStructSize = sizeof(*urlComp);
 
-    urlComp.lpszHostName = host_wc;
-    urlComp.dwHostNameLength  = (DWORD)(url_len + 1);
+    urlComp->lpszHostName = host_wc;
+    urlComp->dwHostNameLength  = (DWORD)(url_len + 1);
 
-    urlComp.lpszUrlPath = path_wc;
-    urlComp.dwUrlPathLength   = (DWORD)(url_len + 1);
+    urlComp->lpszUrlPath = path_wc;
+    urlComp->dwUrlPathLength   = (DWORD)(url_len + 1);
 
     // Crack the url_wc.
-    if (!WinHttpCrackUrl(url_wc, 0, 0, &urlComp)) {
+    if (!WinHttpCrackUrl(url_wc, 0, 0, urlComp)) {
         log_msg("Error %u in WinHttpCrackUrl.", GetLastError());
-        goto error_out;
+        return 0;
     }
 
+    return 1;
+}
+
+/*
+ * Synchronous WinHTTP calls return at once when another thread closes the
+ * request handle, that is how tlasxp_run_cancel() interrupts a transfer.
+ */
+static void
+close_request(void *ref)
+{
+    WinHttpCloseHandle((HINTERNET)ref);
+}
+
+/* GET path_wc over hConnect, connections are kept alive by the session */
+static int
+get_request(HINTERNET hConnect, const WCHAR *path_wc, int secure, FILE *f, int *ret_len,
+            run_ctl_t *rc, double timeout, http_tap_t *tap)
+{
+    DWORD dwSize = 0;
+    DWORD dwDownloaded = 0;
+    BOOL  bResults = FALSE;
+    HINTERNET hRequest = NULL;
+    run_wake_t w;
     char buffer[16 * 1024];
 
-    // Use WinHttpOpen to obtain a session handle.
-    hSession = WinHttpOpen( L"toliss_sb",
-            WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-            WINHTTP_NO_PROXY_NAME,
-            WINHTTP_NO_PROXY_BYPASS, 0 );
+    int result = 0;
+    if (ret_len)
+        *ret_len = 0;
 
-    if (NULL == hSession) {
-        log_msg("Can't open HTTP session");
-        goto error_out;
+    hRequest = WinHttpOpenRequest(hConnect, L"GET", path_wc, NULL, WINHTTP_NO_REFERER,
+                                  WINHTTP_DEFAULT_ACCEPT_TYPES,
+                                  secure ? WINHTTP_FLAG_SECURE : 0);
+    if (NULL == hRequest) {
+        log_msg("Can't open HTTP request: %u", GetLastError());
+        return 0;
     }
 
-    timeout *= 1000;
-    if (! WinHttpSetTimeouts(hSession, timeout, timeout, timeout, timeout)) {
-        log_msg("can't set timeouts");
-        goto error_out;
-    }
+    if (rc)
+        tlasxp_run_wake_add(&w, rc, close_request, hRequest);
 
-    hConnect = WinHttpConnect(hSession, host_wc, urlComp.nPort, 0);
-    if (NULL == hConnect) {
-        log_msg("Can't open HTTP session");
+    /* a cancel before the registration did not see us */
+    if (tlasxp_run_aborted(rc))
         goto error_out;
+
+    /* until the response arrives the first byte timeout applies */
+    int timeout_ms = (int)(timeout * 1000.0) + 1;
+    int ttfb_ms = timeout_ms;
+    if (rc && rc->first_byte_deadline > 0.0) {
+        ttfb_ms = (int)((rc->first_byte_deadline - tlasxp_now()) * 1000.0) + 1;
+        if (ttfb_ms > timeout_ms)
+            ttfb_ms = timeout_ms;
+        if (ttfb_ms < 1)
+            ttfb_ms = 1;
     }
 
-    hRequest = WinHttpOpenRequest(hConnect, L"GET", path_wc, NULL, WINHTTP_NO_REFERER,
-                                  WINHTTP_DEFAULT_ACCEPT_TYPES,
-                                  (urlComp.nScheme == INTERNET_SCHEME_HTTPS) ? WINHTTP_FLAG_SECURE : 0);
-    if (NULL == hRequest) {
-        log_msg("Can't open HTTP request: %u", GetLastError());
+    if (! WinHttpSetTimeouts(hRequest, ttfb_ms, ttfb_ms, ttfb_ms, ttfb_ms)) {
+        log_msg("can't set timeouts");
         goto error_out;
     }
 
@@ -113,7 +149,39 @@ int tlasxp_http_get(const char *url, FILE *f, int *ret_len, int timeout)
         goto error_out;
     }
 
+    if (rc)
+        tlasxp_run_first_byte(rc);
+
+    if (ttfb_ms != timeout_ms)
+        WinHttpSetOption(hRequest, WINHTTP_OPTION_RECEIVE_TIMEOUT, &timeout_ms, sizeof(timeout_ms));
+
+    if (tap) {
+        DWORD hdr_size = 0;
+        WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX,
+                            NULL, &hdr_size, WINHTTP_NO_HEADER_INDEX);
+        if (hdr_size > 0) {
+            WCHAR *hdr_wc = malloc(hdr_size + sizeof(WCHAR));
+            char *hdr = malloc(hdr_size + 1);
+            if (hdr_wc && hdr
+                && WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF, WINHTTP_HEADER_NAME_BY_INDEX,
+                                       hdr_wc, &hdr_size, WINHTTP_NO_HEADER_INDEX)) {
+                size_t len;
+                wcstombs_s(&len, hdr, hdr_size + 1, hdr_wc, _TRUNCATE);
+                tlasxp_http_tap_header(tap, hdr, strlen(hdr));
+            }
+
+            free(hdr_wc);
+            free(hdr);
+        }
+    }
+
     while (1) {
+        /* a cancel closes hRequest, deadlines are checked between chunks */
+        if (tlasxp_run_aborted(rc)) {
+            log_msg("tlasxp_http_get: run aborted");
+            goto error_out;
+        }
+
         DWORD res = WinHttpQueryDataAvailable(hRequest, &dwSize);
         if (!res) {
             log_msg("%d, Error %u in WinHttpQueryDataAvailable.", res, GetLastError());
@@ -142,6 +210,9 @@ int tlasxp_http_get(const char *url, FILE *f, int *ret_len, int timeout)
                 }
             }
 
+            if (tap)
+                tlasxp_http_tap_chunk(tap, buffer, dwDownloaded);
+
             dwSize -= dwDownloaded;
             if (ret_len)
                 *ret_len += dwDownloaded;
@@ -150,12 +221,123 @@ int tlasxp_http_get(const char *url, FILE *f, int *ret_len, int timeout)
 
     result = 1;
 
+error_out:
+    /* once removed the handle can't be closed by a cancel anymore */
+    if (! (rc && tlasxp_run_wake_remove(&w)))
+        WinHttpCloseHandle(hRequest);
+    else if (! result)
+        log_msg("tlasxp_http_get: run canceled");
+    return result;
+}
+
+/* WinHTTP needs no global setup */
+int tlasxp_http_native_init(void)
+{
+    return 1;
+}
+
+void tlasxp_http_native_cleanup(void)
+{
+}
+
+int tlasxp_http_native_get(const char *url, FILE *f, int *ret_len, run_ctl_t *rc, double timeout,
+                           http_tap_t *tap)
+{
+    HINTERNET  hSession = NULL,
+               hConnect = NULL;
+
+    int result = 0;
+    if (ret_len)
+        *ret_len = 0;
+
+    if (tlasxp_run_aborted(rc)) {
+        log_msg("tlasxp_http_get: run aborted, '%s' not fetched", url);
+        return 0;
+    }
+
+    int url_len = strlen(url);
+    WCHAR *host_wc = alloca((url_len + 1) * sizeof(WCHAR));
+    WCHAR *path_wc = alloca((url_len + 1) * sizeof(WCHAR));
+    URL_COMPONENTS urlComp;
+
+    if (! crack_url(url, host_wc, path_wc, &urlComp))
+        goto error_out;
+
+    if (NULL == (hSession = open_session()))
+        goto error_out;
+
+    hConnect = WinHttpConnect(hSession, host_wc, urlComp.nPort, 0);
+    if (NULL == hConnect) {
+        log_msg("Can't open HTTP session");
+        goto error_out;
+    }
+
+    result = get_request(hConnect, path_wc, urlComp.nScheme == INTERNET_SCHEME_HTTPS,
+                         f, ret_len, rc, timeout, tap);
+
 error_out:
     // Close any open handles.
-    if (hRequest) WinHttpCloseHandle(hRequest);
     if (hConnect) WinHttpCloseHandle(hConnect);
     if (hSession) WinHttpCloseHandle(hSession);
 
     log_msg("tlasxp_http_get result: %d", result);
     return result;
 }
+
+native_conn_t *
+tlasxp_http_native_conn_open(const char *base_url)
+{
+    int url_len = strlen(base_url);
+    WCHAR *host_wc = alloca((url_len + 1) * sizeof(WCHAR));
+    WCHAR *path_wc = alloca((url_len + 1) * sizeof(WCHAR));
+    URL_COMPONENTS urlComp;
+
+    if (! crack_url(base_url, host_wc, path_wc, &urlComp))
+        return NULL;
+
+    native_conn_t *conn = calloc(1, sizeof(native_conn_t));
+    if (NULL == conn)
+        return NULL;
+
+    conn->secure = (urlComp.nScheme == INTERNET_SCHEME_HTTPS);
+
+    if (NULL == (conn->hSession = open_session()))
+        goto error_out;
+
+    conn->hConnect = WinHttpConnect(conn->hSession, host_wc, urlComp.nPort, 0);
+    if (NULL == conn->hConnect) {
+        log_msg("Can't open HTTP session");
+        goto error_out;
+    }
+
+    return conn;
+
+error_out:
+    tlasxp_http_native_conn_close(conn);
+    return NULL;
+}
+
+int
+tlasxp_http_native_conn_get(native_conn_t *conn, const char *path, FILE *f, int *ret_len,
+                            run_ctl_t *rc, double timeout, http_tap_t *tap)
+{
+    if (tlasxp_run_aborted(rc))
+        return 0;
+
+    int path_len = strlen(path);
+    WCHAR *path_wc = alloca((path_len + 1) * sizeof(WCHAR));
+    mbstowcs_s(NULL, path_wc, path_len + 1, path, _TRUNCATE);
+
+    return get_request(conn->hConnect, path_wc, conn->secure, f, ret_len, rc, timeout, tap);
+}
+
+void
+tlasxp_http_native_conn_close(native_conn_t *conn)
+{
+    if (NULL == conn)
+        return;
+
+    if (conn->hConnect) WinHttpCloseHandle(conn->hConnect);
+    if (conn->hSession) WinHttpCloseHandle(conn->hSession);
+    free(conn);
+}
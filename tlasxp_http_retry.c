@@ -0,0 +1,304 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Retry and hedging on top of the single shot tlasxp_http_get() of the backends.
+ * Only for idempotent GETs, e.g. the SimBrief downloads.
+ *
+ * A failed attempt is retried after an exponential backoff with full jitter
+ * as long as the caller's time budget permits.
+ * If an attempt did not see its first byte after the hedge delay a second
+ * identical request is sent on a helper thread. Whichever completes first wins,
+ * the other one is canceled.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define N_TTFB 32           /* # of time to first byte samples we learn from */
+#define MIN_TTFB_SAMPLES 10
+#define MIN_HEDGE_DELAY 0.1
+
+retry_policy_t tlasxp_retry_policy =
+{
+    .max_attempts = 3,
+    .backoff_base = 0.25,
+    .backoff_cap = 2.0,
+    .hedge_delay = 1.5
+};
+
+http_stats_t tlasxp_http_stats;
+
+static pthread_mutex_t ttfb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static double ttfb[N_TTFB];
+static int n_ttfb, ttfb_idx;
+static int hedge_seq;
+
+typedef struct _hedge
+{
+    const char *url;
+    FILE *f;                    /* hedge's output, NULL if the caller discards the body */
+    char fn[600];
+    run_ctl_t *primary;
+    volatile int primary_done;
+    run_ctl_t rc;               /* of the hedge request */
+    double delay;
+    double t_start;
+    int len;
+    volatile int winner;        /* 0: none, 1: primary, 2: hedge */
+} hedge_t;
+
+#define STAT_INC(field) __atomic_add_fetch(&tlasxp_http_stats.field, 1, __ATOMIC_RELAXED)
+
+static void
+add_ttfb(double t)
+{
+    pthread_mutex_lock(&ttfb_mutex);
+    ttfb[ttfb_idx] = t;
+    ttfb_idx = (ttfb_idx + 1) % N_TTFB;
+    if (n_ttfb < N_TTFB)
+        n_ttfb++;
+    pthread_mutex_unlock(&ttfb_mutex);
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* learned p95 of the time to first byte, 0 if not enough samples yet */
+static double
+ttfb_p95(void)
+{
+    double s[N_TTFB];
+    int n;
+
+    pthread_mutex_lock(&ttfb_mutex);
+    n = n_ttfb;
+    memcpy(s, ttfb, n * sizeof(double));
+    pthread_mutex_unlock(&ttfb_mutex);
+
+    if (n < MIN_TTFB_SAMPLES)
+        return 0.0;
+
+    qsort(s, n, sizeof(double), cmp_double);
+    return s[(int)(0.95 * (n - 1))];
+}
+
+static double
+hedge_delay(void)
+{
+    double delay = tlasxp_retry_policy.hedge_delay;
+    if (delay <= 0.0)
+        return 0.0;
+
+    double p95 = ttfb_p95();
+    if (p95 > 0.0 && p95 < delay)
+        delay = (p95 > MIN_HEDGE_DELAY) ? p95 : MIN_HEDGE_DELAY;
+    return delay;
+}
+
+/* truncate f for a fresh download */
+static void
+reset_file(FILE *f)
+{
+    fflush(f);
+    rewind(f);
+    if (ftruncate(fileno(f), 0))
+        log_msg("can't truncate output file");
+}
+
+static int
+copy_file(const char *fn, FILE *f)
+{
+    char buffer[16 * 1024];
+    FILE *src = fopen(fn, "rb");
+    if (NULL == src)
+        return 0;
+
+    reset_file(f);
+
+    size_t n;
+    while (0 < (n = fread(buffer, 1, sizeof(buffer), src)))
+        fwrite(buffer, 1, n, f);
+
+    fclose(src);
+    fflush(f);
+    return ! ferror(f);
+}
+
+static void *
+hedge_worker(void *arg)
+{
+    hedge_t *h = arg;
+    double first_byte;
+
+    /* wait for the hedge delay unless the primary makes progress or terminates */
+    double t_hedge = tlasxp_now() + h->delay;
+    while (tlasxp_now() < t_hedge) {
+        __atomic_load(&h->primary->first_byte, &first_byte, __ATOMIC_ACQUIRE);
+        if (h->primary_done || first_byte > 0.0 || tlasxp_run_aborted(&h->rc))
+            return NULL;
+        usleep(10 * 1000);
+    }
+
+    __atomic_load(&h->primary->first_byte, &first_byte, __ATOMIC_ACQUIRE);
+    if (h->primary_done || first_byte > 0.0)
+        return NULL;
+
+    STAT_INC(hedges);
+    log_msg("no response after %0.2f s, hedging '%s'", h->delay, h->url);
+
+    if (h->f) {
+        snprintf(h->fn, sizeof(h->fn), "%s.h%d", tlasxp_tmp_fn,
+                 __atomic_add_fetch(&hedge_seq, 1, __ATOMIC_RELAXED));
+        FILE *f = fopen(h->fn, "wb");
+        if (NULL == f) {
+            log_msg("Can't create hedge file '%s'", h->fn);
+            h->fn[0] = '\0';
+            return NULL;
+        }
+
+        h->t_start = tlasxp_now();
+        int res = tlasxp_http_get(h->url, f, &h->len, &h->rc, h->rc.deadline - h->t_start);
+        fclose(f);
+        if (! res)
+            return NULL;
+    } else {
+        h->t_start = tlasxp_now();
+        if (! tlasxp_http_get(h->url, NULL, NULL, &h->rc, h->rc.deadline - h->t_start))
+            return NULL;
+    }
+
+    int none = 0;
+    if (__atomic_compare_exchange_n(&h->winner, &none, 2, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        tlasxp_run_cancel(h->primary);
+    return NULL;
+}
+
+/* one attempt, possibly hedged, until t_end */
+static int
+attempt(const char *url, FILE *f, int *ret_len, run_ctl_t *rc, double t_end)
+{
+    double t0 = tlasxp_now();
+    run_ctl_t prc;
+    hedge_t h;
+    pthread_t hedge_thread;
+
+    memset(&h, 0, sizeof(h));
+    tlasxp_run_init_child(&prc, rc, t_end - t0);
+    tlasxp_run_init_child(&h.rc, rc, t_end - t0);
+    h.url = url;
+    h.f = f;
+    h.primary = &prc;
+    h.delay = hedge_delay();
+
+    int hedging = (h.delay > 0.0) && (0 == pthread_create(&hedge_thread, NULL, hedge_worker, &h));
+
+    int res = tlasxp_http_get(url, f, ret_len, &prc, t_end - t0);
+    __atomic_store_n(&h.primary_done, 1, __ATOMIC_RELEASE);
+
+    int none = 0;
+    if (res && __atomic_compare_exchange_n(&h.winner, &none, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        tlasxp_run_cancel(&h.rc);
+
+    if (hedging)
+        pthread_join(hedge_thread, NULL);
+
+    if (prc.first_byte > 0.0)
+        add_ttfb(prc.first_byte - t0);
+
+    if (2 == h.winner) {
+        STAT_INC(hedge_wins);
+        log_msg("hedge request won");
+        add_ttfb(h.rc.first_byte - h.t_start);
+        res = 1;
+        if (f) {
+            res = copy_file(h.fn, f);
+            if (ret_len)
+                *ret_len = h.len;
+        }
+    }
+
+    if (h.fn[0])
+        unlink(h.fn);
+
+    return res;
+}
+
+int
+tlasxp_http_get_retry(const char *url, FILE *f, int *ret_len, run_ctl_t *rc, double timeout)
+{
+    const retry_policy_t *pol = &tlasxp_retry_policy;
+    double t_end = tlasxp_now() + timeout;
+    if (rc && rc->deadline < t_end)
+        t_end = rc->deadline;
+
+    STAT_INC(requests);
+
+    for (int i = 0; i < pol->max_attempts; i++) {
+        if (i > 0) {
+            double backoff = pol->backoff_base * (1 << (i - 1));
+            if (backoff > pol->backoff_cap)
+                backoff = pol->backoff_cap;
+            backoff *= (double)rand() / RAND_MAX;
+
+            /* the time budget caps the retries */
+            if (tlasxp_now() + backoff >= t_end)
+                break;
+
+            log_msg("retry #%d of '%s' in %0.2f s", i, url, backoff);
+            if (! tlasxp_run_sleep(rc, backoff))
+                break;
+
+            STAT_INC(retries);
+            if (f)
+                reset_file(f);
+        }
+
+        if (attempt(url, f, ret_len, rc, t_end))
+            return 1;
+
+        if (tlasxp_run_aborted(rc) || tlasxp_now() >= t_end)
+            break;
+    }
+
+    STAT_INC(failures);
+    return 0;
+}
+
+void
+tlasxp_http_log_stats(void)
+{
+    log_msg("http stats: requests: %d, retries: %d, hedges: %d, hedge wins: %d, failures: %d, ttfb p95: %0.3f s",
+            tlasxp_http_stats.requests, tlasxp_http_stats.retries, tlasxp_http_stats.hedges,
+            tlasxp_http_stats.hedge_wins, tlasxp_http_stats.failures, ttfb_p95());
+}
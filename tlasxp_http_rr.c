@@ -0,0 +1,478 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * HTTP transport: the native backend (curl or WinHTTP) with optional
+ * record and replay. Timeouts are adapted to the endpoint (tlasxp_latency.c).
+ *
+ * With TLASXP_HTTP_RR=record:<file> every exchange of the native backend is
+ * appended to <file>: headers, chunk boundaries and timings relative to the
+ * start of the request.
+ * With TLASXP_HTTP_RR=replay:<file> no network is used. Requests are answered
+ * from <file> with the recorded timing scaled by TLASXP_HTTP_RR_SCALE
+ * (default 1.0, 0 = no delays). Repeated requests of the same url cycle
+ * through the recorded exchanges.
+ *
+ * File format, per exchange:
+ *  X <url>
+ *  H <t> <len>     followed by len bytes of raw headers and a newline
+ *  C <t> <len>     followed by len bytes of body and a newline, repeated
+ *  E <t> <result>
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+enum { RR_NATIVE, RR_RECORD, RR_REPLAY };
+
+struct _http_tap
+{
+    double t0;
+    char *buf;          /* serialized H and C records */
+    size_t len, size;
+    int failed;         /* out of memory */
+};
+
+struct _http_conn
+{
+    native_conn_t *native;      /* NULL in replay mode */
+    char base_url[200];
+};
+
+typedef struct _exchange
+{
+    char url[500];
+    const char *hdr;
+    size_t hdr_len;
+    double t_hdr;
+    const char *chunks;         /* first C record */
+    double t_end;
+    int result;
+    int uses;
+} exchange_t;
+
+static pthread_once_t rr_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t rr_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int rr_mode;
+static char rr_fn[500];
+static double rr_scale = 1.0;
+
+static char *replay_data;
+static long replay_size;
+static exchange_t *exchanges;
+static int n_exchanges;
+
+static void
+tap_append(http_tap_t *tap, const void *data, size_t len)
+{
+    if (tap->failed)
+        return;
+
+    if (tap->len + len > tap->size) {
+        size_t size = 2 * tap->size + len + 1024;
+        char *buf = realloc(tap->buf, size);
+        if (NULL == buf) {
+            tap->failed = 1;
+            return;
+        }
+
+        tap->buf = buf;
+        tap->size = size;
+    }
+
+    memcpy(tap->buf + tap->len, data, len);
+    tap->len += len;
+}
+
+static void
+tap_record(http_tap_t *tap, char type, const void *data, size_t len)
+{
+    char line[100];
+    int n = snprintf(line, sizeof(line), "%c %0.6f %lu\n", type, tlasxp_now() - tap->t0,
+                     (unsigned long)len);
+    tap_append(tap, line, n);
+    tap_append(tap, data, len);
+    tap_append(tap, "\n", 1);
+}
+
+/* called by the backends */
+void
+tlasxp_http_tap_header(http_tap_t *tap, const char *data, size_t len)
+{
+    tap_record(tap, 'H', data, len);
+}
+
+void
+tlasxp_http_tap_chunk(http_tap_t *tap, const void *data, size_t len)
+{
+    tap_record(tap, 'C', data, len);
+}
+
+static void
+tap_write(http_tap_t *tap, const char *url, int result)
+{
+    if (tap->failed) {
+        log_msg("http rr: out of memory, exchange of '%s' not recorded", url);
+        goto out;
+    }
+
+    pthread_mutex_lock(&rr_mutex);
+    FILE *f = fopen(rr_fn, "ab");
+    if (f) {
+        fprintf(f, "X %s\n", url);
+        fwrite(tap->buf, 1, tap->len, f);
+        fprintf(f, "E %0.6f %d\n", tlasxp_now() - tap->t0, result);
+        fclose(f);
+    } else {
+        log_msg("http rr: can't append to '%s'", rr_fn);
+    }
+    pthread_mutex_unlock(&rr_mutex);
+
+  out:
+    free(tap->buf);
+}
+
+/* parse a "T t len\n" record header, return pointer to the data or NULL */
+static const char *
+parse_record(const char *p, const char *end, char type, double *t, size_t *len)
+{
+    char *q;
+
+    if (p >= end || *p != type)
+        return NULL;
+
+    *t = strtod(p + 1, &q);
+    unsigned long l = strtoul(q, &q, 10);
+    if ('\n' != *q)
+        return NULL;
+
+    p = q + 1;
+    if (p + l > end)
+        return NULL;
+
+    *len = l;
+    return p;
+}
+
+static void
+load_replay(void)
+{
+    FILE *f = fopen(rr_fn, "rb");
+    if (NULL == f) {
+        log_msg("http rr: can't open '%s', all requests will fail", rr_fn);
+        return;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+
+    replay_data = malloc(size + 1);
+    if (NULL == replay_data || size != (long)fread(replay_data, 1, size, f)) {
+        log_msg("http rr: can't read '%s'", rr_fn);
+        fclose(f);
+        return;
+    }
+
+    fclose(f);
+    replay_data[size] = '\0';
+    replay_size = size;
+
+    const char *p = replay_data, *end = replay_data + size;
+    int n_alloc = 0;
+
+    while (p < end && 'X' == *p) {
+        if (n_exchanges == n_alloc) {
+            n_alloc = 2 * n_alloc + 16;
+            exchanges = realloc(exchanges, n_alloc * sizeof(exchange_t));
+            if (NULL == exchanges) {
+                n_exchanges = 0;
+                return;
+            }
+        }
+
+        exchange_t *e = &exchanges[n_exchanges];
+        memset(e, 0, sizeof(*e));
+
+        const char *nl = memchr(p, '\n', end - p);
+        if (NULL == nl)
+            break;
+        snprintf(e->url, sizeof(e->url), "%.*s", (int)(nl - p - 2), p + 2);
+        p = nl + 1;
+
+        double t;
+        size_t len;
+        const char *d;
+
+        /* headers of redirects or (curl) single header lines are merged */
+        while (NULL != (d = parse_record(p, end, 'H', &t, &len))) {
+            if (NULL == e->hdr) {
+                e->hdr = d;
+                e->t_hdr = t;
+            }
+            e->hdr_len = d + len - e->hdr;
+            p = d + len + 1;
+        }
+
+        e->chunks = p;
+        while (NULL != (d = parse_record(p, end, 'C', &t, &len)))
+            p = d + len + 1;
+
+        if (p >= end || 'E' != *p)
+            break;
+
+        char *q;
+        e->t_end = strtod(p + 1, &q);
+        e->result = strtol(q, NULL, 10);
+
+        p = memchr(p, '\n', end - p);
+        p = p ? p + 1 : end;
+        n_exchanges++;
+    }
+
+    log_msg("http rr: %d exchanges loaded from '%s', time scale: %0.2f", n_exchanges, rr_fn, rr_scale);
+}
+
+static void
+rr_init(void)
+{
+    const char *rr = getenv("TLASXP_HTTP_RR");
+    if (NULL == rr)
+        return;
+
+    if (0 == strncmp(rr, "record:", 7)) {
+        rr_mode = RR_RECORD;
+        snprintf(rr_fn, sizeof(rr_fn), "%s", rr + 7);
+        log_msg("http rr: recording to '%s'", rr_fn);
+    } else if (0 == strncmp(rr, "replay:", 7)) {
+        rr_mode = RR_REPLAY;
+        snprintf(rr_fn, sizeof(rr_fn), "%s", rr + 7);
+        const char *scale = getenv("TLASXP_HTTP_RR_SCALE");
+        if (scale)
+            rr_scale = atof(scale);
+        load_replay();
+    } else {
+        log_msg("http rr: invalid TLASXP_HTTP_RR '%s' ignored", rr);
+    }
+}
+
+/* wait until recorded time t of a replayed exchange, return 0 on abort or timeout */
+static int
+replay_wait(run_ctl_t *rc, double t0, double t, double timeout)
+{
+    double t_end = t0 + rr_scale * t;
+    int timed_out = (rr_scale * t > timeout);
+    if (timed_out)
+        t_end = t0 + timeout;
+
+    double now;
+    while ((now = tlasxp_now()) < t_end) {
+        if (tlasxp_run_aborted(rc))
+            return 0;
+
+        double dt = t_end - now;
+        usleep((dt < 0.02 ? dt : 0.02) * 1.0E6);
+    }
+
+    return ! timed_out && ! tlasxp_run_aborted(rc);
+}
+
+static int
+replay(const char *url, FILE *f, int *ret_len, run_ctl_t *rc, double timeout)
+{
+    double t0 = tlasxp_now();
+    if (ret_len)
+        *ret_len = 0;
+
+    if (tlasxp_run_aborted(rc))
+        return 0;
+
+    /* the least used matching exchange */
+    exchange_t *e = NULL;
+    pthread_mutex_lock(&rr_mutex);
+    for (int i = 0; i < n_exchanges; i++)
+        if (0 == strcmp(exchanges[i].url, url) && (NULL == e || exchanges[i].uses < e->uses))
+            e = &exchanges[i];
+    if (e)
+        e->uses++;
+    pthread_mutex_unlock(&rr_mutex);
+
+    if (NULL == e) {
+        log_msg("http rr: no recorded exchange for '%s'", url);
+        return 0;
+    }
+
+    if (e->hdr) {
+        if (! replay_wait(rc, t0, e->t_hdr, timeout))
+            return 0;
+
+        if (rc)
+            tlasxp_run_first_byte(rc);
+    }
+
+    const char *p = e->chunks, *end = replay_data + replay_size, *d;
+    double t;
+    size_t len;
+
+    while (NULL != (d = parse_record(p, end, 'C', &t, &len))) {
+        if (! replay_wait(rc, t0, t, timeout))
+            return 0;
+
+        if (f && len != fwrite(d, 1, len, f))
+            return 0;
+
+        if (ret_len)
+            *ret_len += len;
+        p = d + len + 1;
+    }
+
+    if (! replay_wait(rc, t0, e->t_end, timeout))
+        return 0;
+
+    return e->result;
+}
+
+/* one transfer over conn if not NULL, else standalone */
+static int
+transfer(http_conn_t *conn, const char *url, const char *path, FILE *f, int *ret_len,
+         run_ctl_t *rc, double timeout)
+{
+    if (RR_REPLAY == rr_mode)
+        return replay(url, f, ret_len, rc, timeout);
+
+    http_tap_t tap = { tlasxp_now() };
+    http_tap_t *tp = (RR_RECORD == rr_mode) ? &tap : NULL;
+
+    int res;
+    if (conn)
+        res = tlasxp_http_native_conn_get(conn->native, path, f, ret_len, rc, timeout, tp);
+    else
+        res = tlasxp_http_native_get(url, f, ret_len, rc, timeout, tp);
+
+    if (tp)
+        tap_write(tp, url, res);
+    return res;
+}
+
+/* a transfer with the timeouts learned for its endpoint, the outcome is learned as well */
+static int
+adaptive_transfer(http_conn_t *conn, const char *url, const char *path, FILE *f, int *ret_len,
+                  run_ctl_t *rc, double timeout)
+{
+    int ep = tlasxp_latency_ep(url);
+    double ttfb_timeout;
+    timeout = tlasxp_latency_timeout(ep, timeout, &ttfb_timeout);
+
+    /* a learned timeout may outlast the caller's stage but not the run */
+    double t0 = tlasxp_now();
+    run_ctl_t arc;
+    tlasxp_run_init(&arc, timeout);
+    arc.parent = rc;
+    arc.deadline = MIN(arc.deadline, tlasxp_run_end(rc));
+    if (ttfb_timeout > 0.0)
+        arc.first_byte_deadline = MIN(t0 + ttfb_timeout, arc.deadline);
+
+    int res = transfer(conn, url, path, f, ret_len, &arc, arc.deadline - t0);
+
+    double t = tlasxp_now() - t0;
+    if (res) {
+        tlasxp_latency_add(ep, (arc.first_byte > 0.0) ? arc.first_byte - t0 : 0.0, t, 0);
+    } else if (! tlasxp_run_aborted(rc)) {
+        /* failures that are not caused by the caller and took about the timeout */
+        double limit = (0.0 == arc.first_byte && ttfb_timeout > 0.0) ? ttfb_timeout : arc.deadline - t0;
+        if (t >= 0.9 * limit) {
+            log_msg("'%s' timed out after %0.2f s", url, t);
+            tlasxp_latency_add(ep, 0.0, t, 1);
+        }
+    }
+
+    return res;
+}
+
+/* once before the first and after the last transfer of all threads */
+int
+tlasxp_http_init(void)
+{
+    pthread_once(&rr_once, rr_init);
+    return tlasxp_http_native_init();
+}
+
+void
+tlasxp_http_cleanup(void)
+{
+    tlasxp_http_native_cleanup();
+}
+
+int
+tlasxp_http_get(const char *url, FILE *f, int *ret_len, run_ctl_t *rc, double timeout)
+{
+    pthread_once(&rr_once, rr_init);
+    return adaptive_transfer(NULL, url, NULL, f, ret_len, rc, timeout);
+}
+
+http_conn_t *
+tlasxp_http_conn_open(const char *base_url)
+{
+    pthread_once(&rr_once, rr_init);
+
+    http_conn_t *conn = calloc(1, sizeof(http_conn_t));
+    if (NULL == conn)
+        return NULL;
+
+    snprintf(conn->base_url, sizeof(conn->base_url), "%s", base_url);
+
+    if (RR_REPLAY != rr_mode && NULL == (conn->native = tlasxp_http_native_conn_open(base_url))) {
+        free(conn);
+        return NULL;
+    }
+
+    return conn;
+}
+
+int
+tlasxp_http_conn_get(http_conn_t *conn, const char *path, FILE *f, int *ret_len,
+                     run_ctl_t *rc, double timeout)
+{
+    char url[500];
+
+    snprintf(url, sizeof(url), "%s%s", conn->base_url, path);
+    return adaptive_transfer(conn, url, path, f, ret_len, rc, timeout);
+}
+
+void
+tlasxp_http_conn_close(http_conn_t *conn)
+{
+    if (NULL == conn)
+        return;
+
+    tlasxp_http_native_conn_close(conn->native);
+    free(conn);
+}
@@ -0,0 +1,617 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Tiny HTTP server for tablets on the seat LAN.
+ *
+ *   /ofp       OFP summary, JSON
+ *   /navlog    navlog fixes, JSON
+ *   /wind      the raw wind_grid_t
+ *   /fms       the FMS plan as downloaded
+ *
+ * The bodies are serialized once per new OFP by the fetch worker and shared
+ * by refcount with the server thread, which sends them as they are. Each body
+ * has an ETag so polling clients mostly get a 304.
+ * One thread multiplexes all connections with poll(), one request per connection.
+ * Sockets are non blocking, a client that does not read stalls only itself.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <errno.h>
+#include <pthread.h>
+
+#ifdef WINDOWS
+#if !defined(_WIN32_WINNT) || _WIN32_WINNT < 0x0600
+#undef _WIN32_WINNT
+#define _WIN32_WINNT 0x0600     /* for WSAPoll */
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET sock_t;
+#define SEND_FLAGS 0
+#define poll(fds, n, timeout) WSAPoll(fds, n, timeout)
+#define would_block() (WSAEWOULDBLOCK == WSAGetLastError())
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+typedef int sock_t;
+#define INVALID_SOCKET (-1)
+#define closesocket(s) close(s)
+#define would_block() (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno)
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0        /* macOS: SO_NOSIGPIPE */
+#endif
+#endif
+
+#include "tlasxp.h"
+
+#define UNUSED(x) (void)(x)
+
+#define MAX_CONN 16
+#define REQ_MAX 2048
+#define CONN_TIMEOUT 5.0    /* s to deliver the request */
+#define SEND_TIMEOUT 2.0    /* s without progress of the response */
+
+enum { RES_OFP, RES_NAVLOG, RES_WIND, RES_FMS, N_RES };
+
+static const char *res_path[N_RES] = { "/ofp", "/navlog", "/wind", "/fms" };
+static const char *res_type[N_RES] = {
+    "application/json", "application/json", "application/octet-stream", "text/plain"
+};
+
+typedef struct _body
+{
+    char *data;
+    int len;
+    char etag[24];
+} body_t;
+
+/* what is served for one OFP, immutable once published */
+typedef struct _content
+{
+    int refs;
+    body_t body[N_RES];
+} content_t;
+
+typedef struct _conn
+{
+    sock_t s;
+    double t_active;        /* accept or last progress of the response */
+    int len;
+    char req[REQ_MAX + 1];
+
+    /* the response: hdr followed by body, sent is the offset into both */
+    int resp_len;           /* 0 while the request is read */
+    int sent;
+    int hdr_len;
+    char hdr[400];
+    const char *body;
+    content_t *ct;          /* holds body */
+} conn_t;
+
+static pthread_mutex_t content_mutex = PTHREAD_MUTEX_INITIALIZER;
+static content_t *content;
+static int content_seq;
+
+static pthread_t httpd_thread;
+static int httpd_running, httpd_stop;
+static sock_t listen_sock = INVALID_SOCKET;
+static int listen_port;
+
+/* growable string */
+typedef struct _sbuf
+{
+    char *buf;
+    int len, cap;
+} sbuf_t;
+
+static void
+sb_printf(sbuf_t *sb, const char *fmt, ...)
+{
+    for (;;) {
+        va_list ap;
+        int avail = sb->cap - sb->len;
+        va_start(ap, fmt);
+        int n = (sb->buf ? vsnprintf(sb->buf + sb->len, avail, fmt, ap) : avail + 1);
+        va_end(ap);
+
+        if (n < 0)
+            return;
+
+        if (n < avail) {
+            sb->len += n;
+            return;
+        }
+
+        int cap = (sb->cap > 0 ? 2 * sb->cap : 4096) + n;
+        char *b = realloc(sb->buf, cap);
+        if (NULL == b)
+            return;
+        sb->buf = b;
+        sb->cap = cap;
+    }
+}
+
+/* "key": "escaped value" */
+static void
+sb_json_str(sbuf_t *sb, const char *sep, const char *key, const char *val)
+{
+    sb_printf(sb, "%s\"%s\": \"", sep, key);
+    for (const char *s = val; *s; s++) {
+        unsigned char c = *s;
+        if ('"' == c || '\\' == c)
+            sb_printf(sb, "\\%c", c);
+        else if (c < 0x20)
+            sb_printf(sb, "\\u%04x", c);
+        else
+            sb_printf(sb, "%c", c);
+    }
+    sb_printf(sb, "\"");
+}
+
+static void
+set_body(body_t *b, char *data, int len)
+{
+    b->data = data;
+    b->len = len;
+    snprintf(b->etag, sizeof(b->etag), "\"%d-%08x\"", content_seq,
+             (unsigned)(tlasxp_hash(data, len, 0) & 0xffffffff));
+}
+
+static void
+content_release(content_t *c)
+{
+    if (NULL == c || __atomic_sub_fetch(&c->refs, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    for (int i = 0; i < N_RES; i++)
+        free(c->body[i].data);
+    free(c);
+}
+
+static content_t *
+content_get(void)
+{
+    pthread_mutex_lock(&content_mutex);
+    content_t *c = content;
+    if (c)
+        __atomic_add_fetch(&c->refs, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&content_mutex);
+    return c;
+}
+
+/*
+ * Serialize a new OFP and the FMS plan in fms_fn, NULL drops the current content.
+ * Runs on the fetch worker.
+ */
+void
+tlasxp_httpd_publish(const ofp_info_t *oi, const char *fms_fn)
+{
+    content_t *c = NULL;
+
+    if (oi) {
+        c = calloc(1, sizeof(*c));
+        if (NULL == c) {
+            log_msg("httpd: can't allocate content");
+            return;
+        }
+
+        c->refs = 1;
+        content_seq++;
+
+        sbuf_t sb = { 0 };
+#define S(field, sep) sb_json_str(&sb, sep, #field, oi->field)
+        S(status, "{\n"); S(units, ",\n"); S(icao_airline, ",\n"); S(flight_number, ",\n");
+        S(aircraft_icao, ",\n"); S(origin, ",\n"); S(origin_rwy, ",\n"); S(destination, ",\n");
+        S(destination_rwy, ",\n"); S(alternate, ",\n"); S(altitude, ",\n"); S(tropopause, ",\n");
+        S(isa_dev, ",\n"); S(wind_component, ",\n"); S(route, ",\n"); S(alt_route, ",\n");
+        S(time_generated, ",\n"); S(est_time_enroute, ",\n"); S(fuel_plan_ramp, ",\n");
+        S(pax_count, ",\n"); S(pax_weight, ",\n"); S(payload, ",\n"); S(est_zfw, ",\n");
+#undef S
+        sb_printf(&sb, "\n}\n");
+        set_body(&c->body[RES_OFP], sb.buf, sb.len);
+
+        sb = (sbuf_t){ 0 };
+        sb_printf(&sb, "[");
+        for (int i = 0; i < oi->n_navlog; i++) {
+            const navlog_fix_t *f = &oi->navlog[i];
+            sb_json_str(&sb, (i > 0) ? ",\n{" : "\n{", "ident", f->ident);
+            sb_json_str(&sb, ", ", "type", f->type);
+            sb_printf(&sb, ", \"lat\": %0.5f, \"lon\": %0.5f, \"altitude\": %d, \"distance\": %d}",
+                      f->lat, f->lon, f->altitude, f->distance);
+        }
+        sb_printf(&sb, "\n]\n");
+        set_body(&c->body[RES_NAVLOG], sb.buf, sb.len);
+
+        char *w = malloc(sizeof(oi->wind));
+        if (w) {
+            memcpy(w, &oi->wind, sizeof(oi->wind));
+            set_body(&c->body[RES_WIND], w, sizeof(oi->wind));
+        }
+
+        mapped_file_t mf;
+        if (fms_fn && tlasxp_map_file(fms_fn, &mf)) {
+            char *fms = malloc(mf.len);
+            if (fms) {
+                memcpy(fms, mf.data, mf.len);
+                set_body(&c->body[RES_FMS], fms, mf.len);
+            }
+            tlasxp_unmap_file(&mf);
+        }
+    }
+
+    pthread_mutex_lock(&content_mutex);
+    content_t *old = content;
+    content = c;
+    pthread_mutex_unlock(&content_mutex);
+    content_release(old);
+}
+
+/* queue the response, body is part of ct which is released when it is sent */
+static void
+respond(conn_t *c, const char *hdr, int hdr_len, const char *body, int body_len, content_t *ct)
+{
+    memcpy(c->hdr, hdr, hdr_len);
+    c->hdr_len = hdr_len;
+    c->body = body;
+    c->resp_len = hdr_len + body_len;
+    c->sent = 0;
+    c->ct = ct;
+}
+
+static void
+send_status(conn_t *c, const char *status)
+{
+    char hdr[200];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    respond(c, hdr, n, NULL, 0, NULL);
+}
+
+/* header value of name in the request or NULL */
+static const char *
+req_header(const char *req, const char *name)
+{
+    int l = strlen(name);
+    for (const char *p = strstr(req, "\r\n"); p; p = strstr(p, "\r\n")) {
+        p += 2;
+        if (0 == strncasecmp(p, name, l) && ':' == p[l]) {
+            p += l + 1;
+            while (' ' == *p)
+                p++;
+            return p;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+handle_request(conn_t *c)
+{
+    char method[8], path[100];
+    if (2 != sscanf(c->req, "%7s %99s", method, path)) {
+        send_status(c, "400 Bad Request");
+        return;
+    }
+
+    int head = (0 == strcmp(method, "HEAD"));
+    if (! head && strcmp(method, "GET")) {
+        send_status(c, "405 Method Not Allowed");
+        return;
+    }
+
+    char *q = strchr(path, '?');
+    if (q)
+        *q = '\0';
+
+    int r = 0;
+    while (r < N_RES && strcmp(path, res_path[r]))
+        r++;
+
+    if (N_RES == r) {
+        send_status(c, "404 Not Found");
+        return;
+    }
+
+    content_t *ct = content_get();
+    const body_t *b = ct ? &ct->body[r] : NULL;
+    if (NULL == b || NULL == b->data) {
+        send_status(c, "404 Not Found");
+        content_release(ct);
+        return;
+    }
+
+    const char *inm = req_header(c->req, "If-None-Match");
+    int not_modified = (inm && 0 == strncmp(inm, b->etag, strlen(b->etag)));
+
+    char hdr[400];
+    int n = snprintf(hdr, sizeof(hdr),
+                     "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nETag: %s\r\n"
+                     "Cache-Control: no-cache\r\nAccess-Control-Allow-Origin: *\r\nConnection: close\r\n\r\n",
+                     not_modified ? "304 Not Modified" : "200 OK", res_type[r],
+                     not_modified ? 0 : b->len, b->etag);
+    if (head || not_modified)
+        respond(c, hdr, n, NULL, 0, ct);
+    else
+        respond(c, hdr, n, b->data, b->len, ct);
+}
+
+static void
+conn_close(conn_t *c)
+{
+    closesocket(c->s);
+    c->s = INVALID_SOCKET;
+    content_release(c->ct);
+    c->ct = NULL;
+}
+
+static int
+set_nonblocking(sock_t s)
+{
+#ifdef WINDOWS
+    u_long one = 1;
+    return 0 == ioctlsocket(s, FIONBIO, &one);
+#else
+    int fl = fcntl(s, F_GETFL);
+    return fl >= 0 && 0 == fcntl(s, F_SETFL, fl | O_NONBLOCK);
+#endif
+}
+
+/* send what the socket takes, close the connection when the response is out */
+static void
+conn_write(conn_t *c)
+{
+    while (c->sent < c->resp_len) {
+        const char *data;
+        int len;
+        if (c->sent < c->hdr_len) {
+            data = c->hdr + c->sent;
+            len = c->hdr_len - c->sent;
+        } else {
+            data = c->body + (c->sent - c->hdr_len);
+            len = c->resp_len - c->sent;
+        }
+
+        int n = send(c->s, data, len, SEND_FLAGS);
+        if (n <= 0) {
+            if (n < 0 && would_block())
+                return;
+            break;
+        }
+
+        c->sent += n;
+        c->t_active = tlasxp_now();
+    }
+
+    conn_close(c);
+}
+
+static void
+conn_accept(conn_t *conns)
+{
+    sock_t s = accept(listen_sock, NULL, NULL);
+    if (INVALID_SOCKET == s)
+        return;
+
+    for (int i = 0; i < MAX_CONN; i++) {
+        if (INVALID_SOCKET == conns[i].s) {
+            if (! set_nonblocking(s))
+                break;
+
+            conn_t *c = &conns[i];
+            c->s = s;
+            c->len = 0;
+            c->resp_len = 0;
+            c->ct = NULL;
+            c->t_active = tlasxp_now();
+#ifdef SO_NOSIGPIPE
+            int one = 1;
+            setsockopt(s, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+            return;
+        }
+    }
+
+    closesocket(s);     /* too busy */
+}
+
+static void
+conn_read(conn_t *c)
+{
+    int n = recv(c->s, c->req + c->len, REQ_MAX - c->len, 0);
+    if (n < 0 && would_block())
+        return;
+
+    if (n <= 0) {
+        conn_close(c);
+        return;
+    }
+
+    c->len += n;
+    c->req[c->len] = '\0';
+
+    if (strstr(c->req, "\r\n\r\n"))
+        handle_request(c);
+    else if (c->len >= REQ_MAX)
+        send_status(c, "431 Request Header Fields Too Large");
+    else
+        return;
+
+    c->t_active = tlasxp_now();
+    conn_write(c);      /* most responses go out right away */
+}
+
+static void *
+httpd_loop(void *arg)
+{
+    UNUSED(arg);
+    conn_t conns[MAX_CONN];
+    for (int i = 0; i < MAX_CONN; i++)
+        conns[i].s = INVALID_SOCKET;
+
+    while (! __atomic_load_n(&httpd_stop, __ATOMIC_ACQUIRE)) {
+        /* pfd[0] is the listening socket, pfd[j] belongs to conns[ci[j]] */
+        struct pollfd pfd[MAX_CONN + 1];
+        int ci[MAX_CONN + 1];
+        int n_pfd = 0;
+
+        pfd[n_pfd].fd = listen_sock;
+        pfd[n_pfd].events = POLLIN;
+        pfd[n_pfd++].revents = 0;
+        for (int i = 0; i < MAX_CONN; i++)
+            if (INVALID_SOCKET != conns[i].s) {
+                ci[n_pfd] = i;
+                pfd[n_pfd].fd = conns[i].s;
+                pfd[n_pfd].events = conns[i].resp_len ? POLLOUT : POLLIN;
+                pfd[n_pfd++].revents = 0;
+            }
+
+        /* the timeout bounds the latency of stop */
+        int n = poll(pfd, n_pfd, 250);
+        if (n < 0)
+            continue;
+
+        if (pfd[0].revents & POLLIN)
+            conn_accept(conns);
+
+        double now = tlasxp_now();
+        for (int j = 1; j < n_pfd; j++) {
+            conn_t *c = &conns[ci[j]];
+            if (c->resp_len) {
+                if (pfd[j].revents & (POLLOUT | POLLERR | POLLHUP))
+                    conn_write(c);  /* an error fails the send */
+                else if (now > c->t_active + SEND_TIMEOUT)
+                    conn_close(c);
+            } else if (pfd[j].revents & (POLLIN | POLLERR | POLLHUP)) {
+                conn_read(c);   /* a hangup or error reads as 0 or < 0 */
+            } else if (now > c->t_active + CONN_TIMEOUT) {
+                conn_close(c);
+            }
+        }
+    }
+
+    for (int i = 0; i < MAX_CONN; i++)
+        if (INVALID_SOCKET != conns[i].s)
+            conn_close(&conns[i]);
+
+    return NULL;
+}
+
+/* serve on port, 0 = disabled; return success == 1 */
+int
+tlasxp_httpd_start(int port)
+{
+    if (httpd_running || port <= 0)
+        return 1;
+
+#ifdef WINDOWS
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+        log_msg("httpd: WSAStartup failed");
+        return 0;
+    }
+#endif
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (INVALID_SOCKET == listen_sock) {
+        log_msg("httpd: can't create socket");
+        goto err;
+    }
+
+    int one = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&one, sizeof(one));
+    set_nonblocking(listen_sock);   /* a client gone before accept() must not block us */
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+
+    if (bind(listen_sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(listen_sock, 8)) {
+        log_msg("httpd: can't listen on port %d", port);
+        goto err;
+    }
+
+    httpd_stop = 0;
+    if (pthread_create(&httpd_thread, NULL, httpd_loop, NULL)) {
+        log_msg("httpd: can't create thread");
+        goto err;
+    }
+
+    httpd_running = 1;
+    listen_port = port;
+    log_msg("httpd: serving on port %d", port);
+    return 1;
+
+  err:
+    if (INVALID_SOCKET != listen_sock)
+        closesocket(listen_sock);
+    listen_sock = INVALID_SOCKET;
+#ifdef WINDOWS
+    WSACleanup();
+#endif
+    return 0;
+}
+
+/* the content survives for a restart */
+void
+tlasxp_httpd_stop(void)
+{
+    if (! httpd_running)
+        return;
+
+    __atomic_store_n(&httpd_stop, 1, __ATOMIC_RELEASE);
+
+    /* a connect wakes up poll() right away */
+    sock_t s = socket(AF_INET, SOCK_STREAM, 0);
+    if (INVALID_SOCKET != s) {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(listen_port);
+        connect(s, (struct sockaddr *)&addr, sizeof(addr));
+        closesocket(s);
+    }
+
+    pthread_join(httpd_thread, NULL);
+    closesocket(listen_sock);
+    listen_sock = INVALID_SOCKET;
+    httpd_running = 0;
+#ifdef WINDOWS
+    WSACleanup();
+#endif
+    log_msg("httpd: stopped");
+}
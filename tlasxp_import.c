@@ -0,0 +1,535 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Offline import of OFPs that were downloaded elsewhere.
+ *
+ * A watcher thread sleeps on change notifications of a drop folder
+ * (inotify on Linux, kqueue on macOS, change notification handles on Windows),
+ * there is no polling. On every event the folder is scanned and the newest
+ * xml file is read once it is complete, i.e. its root element is closed.
+ * An OFP is handed to the main thread and the file is renamed to *.imported so
+ * it is picked up only once, anything else is renamed to *.rejected. Files that
+ * are older than the last import are left alone.
+ * As there is no SimBrief download of the FMS plan the plan is generated
+ * from the navlog.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#ifdef LIN
+#include <sys/inotify.h>
+#else
+#include <sys/event.h>
+#endif
+#endif
+
+#include "tlasxp.h"
+
+#define UNUSED(x) (void)(x)
+
+#define RETRY_MS 250    /* rescan while a file is still being written */
+
+static char import_dir[512];
+static pthread_t watcher;
+static int running;
+static pthread_mutex_t import_mutex = PTHREAD_MUTEX_INITIALIZER;
+static char *pending;           /* latest xml not yet taken, under import_mutex */
+static int pending_len;
+static volatile int have_pending;
+static int64_t last_mtime;      /* of the last imported file, watcher only */
+
+#ifdef WINDOWS
+static HANDLE stop_event;
+#else
+static int stop_pipe[2] = { -1, -1 };
+#endif
+
+/* return 1 if xml is a complete document, i.e. the root element is closed, *is_ofp tells what it is */
+static int
+xml_complete(const char *xml, int len, int *is_ofp)
+{
+    /* skip declaration, comments and doctype */
+    const char *p = xml;
+    while (NULL != (p = strchr(p, '<'))) {
+        if (0 == strncmp(p, "<!--", 4)) {
+            if (NULL == (p = strstr(p, "-->")))
+                return 0;
+        } else if ('?' != p[1] && '!' != p[1]) {
+            break;
+        }
+        p++;
+    }
+
+    if (NULL == p)
+        return 0;
+
+    int n = strcspn(p + 1, " \t\r\n/>");
+    if (0 == n || n > 50)
+        return 0;
+
+    char etag[60];
+    int el = snprintf(etag, sizeof(etag), "</%.*s>", n, p + 1);
+
+    /* only whitespace may follow the closing tag of the root */
+    const char *e = xml + len;
+    while (e > p && isspace((unsigned char)e[-1]))
+        e--;
+    if (e - p < el || strncmp(e - el, etag, el))
+        return 0;
+
+    *is_ofp = (3 == n && 0 == strncmp(p + 1, "OFP", 3));
+    return 1;
+}
+
+/* read a dropped file, return 1 = imported, 0 = not yet complete, -1 = not an OFP */
+static int
+import_file(const char *name)
+{
+    char fn[1024], new_fn[1040];
+
+    snprintf(fn, sizeof(fn), "%s%s", import_dir, name);
+
+    FILE *f = fopen(fn, "rb");
+    if (NULL == f)
+        return 0;       /* e.g. locked by the writer */
+
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    rewind(f);
+
+    char *xml = NULL;
+    int res = 0;
+
+    if (len > MAX_IMPORT_SIZE) {
+        log_msg("import: '%s' is too large", fn);
+        res = -1;
+        goto out;
+    }
+
+    if (NULL == (xml = malloc(len + 1))) {
+        log_msg("import: can't allocate %ld bytes", len + 1);
+        goto out;
+    }
+
+    len = fread(xml, 1, len, f);
+    xml[len] = '\0';
+
+    /* a file still being written is retried, only a complete document is judged */
+    int is_ofp;
+    if (! xml_complete(xml, len, &is_ofp))
+        goto out;
+
+    if (! is_ofp) {
+        res = -1;
+        goto out;
+    }
+
+    fclose(f);
+    f = NULL;
+
+    /* the file is ours, so it's imported once only */
+    snprintf(new_fn, sizeof(new_fn), "%s.imported", fn);
+    tlasxp_replace_file(fn, new_fn);
+    log_msg("import: got '%s', %ld bytes", fn, len);
+
+    pthread_mutex_lock(&import_mutex);
+    free(pending);
+    pending = xml;
+    pending_len = len;
+    __atomic_store_n(&have_pending, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&import_mutex);
+    xml = NULL;
+    res = 1;
+
+  out:
+    if (f) fclose(f);
+    free(xml);
+
+    if (-1 == res) {
+        snprintf(new_fn, sizeof(new_fn), "%s.rejected", fn);
+        tlasxp_replace_file(fn, new_fn);
+        log_msg("import: '%s' is not an OFP, rejected", fn);
+    }
+
+    return res;
+}
+
+static int
+is_xml(const char *name)
+{
+    int len = strlen(name);
+    return len > 4 && 0 == strcasecmp(name + len - 4, ".xml");
+}
+
+/* name of the newest xml file not older than the last import, return success == 1 */
+static int
+newest_file(char *name, int name_len, int64_t *mtime)
+{
+    int found = 0;
+
+#ifdef WINDOWS
+    char pattern[600];
+    WIN32_FIND_DATAA fd;
+
+    snprintf(pattern, sizeof(pattern), "%s*.xml", import_dir);
+    HANDLE h = FindFirstFileA(pattern, &fd);
+    if (INVALID_HANDLE_VALUE == h)
+        return 0;
+
+    do {
+        if ((fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || ! is_xml(fd.cFileName))
+            continue;
+
+        /* 100 ns ticks */
+        int64_t t = ((int64_t)fd.ftLastWriteTime.dwHighDateTime << 32) | fd.ftLastWriteTime.dwLowDateTime;
+        if (t >= last_mtime && (! found || t > *mtime)) {
+            snprintf(name, name_len, "%s", fd.cFileName);
+            *mtime = t;
+            found = 1;
+        }
+    } while (FindNextFileA(h, &fd));
+
+    FindClose(h);
+#else
+    DIR *d = opendir(import_dir);
+    if (NULL == d)
+        return 0;
+
+    struct dirent *de;
+    while (NULL != (de = readdir(d))) {
+        if ('.' == de->d_name[0] || ! is_xml(de->d_name))
+            continue;
+
+        char fn[1024];
+        struct stat st;
+        snprintf(fn, sizeof(fn), "%s%s", import_dir, de->d_name);
+        if (stat(fn, &st) || ! S_ISREG(st.st_mode))
+            continue;
+
+        int64_t t = st.st_mtime;
+        if (t >= last_mtime && (! found || t > *mtime)) {
+            snprintf(name, name_len, "%s", de->d_name);
+            *mtime = t;
+            found = 1;
+        }
+    }
+
+    closedir(d);
+#endif
+
+    return found;
+}
+
+/* import the newest complete OFP of the drop folder, return 1 if it is still incomplete */
+static int
+scan_dir(void)
+{
+    char name[256];
+    int64_t mtime = 0;
+
+    /* bounded in case a rejected file can't be renamed */
+    for (int i = 0; i < 8 && newest_file(name, sizeof(name), &mtime); i++) {
+        int res = import_file(name);
+        if (1 == res) {
+            last_mtime = mtime;
+            return 0;
+        }
+
+        if (0 == res)
+            return 1;
+
+        /* rejected and renamed, the next one */
+    }
+
+    return 0;
+}
+
+static void *
+watcher_main(void *arg)
+{
+    UNUSED(arg);
+    int n_incomplete = scan_dir();     /* files dropped while we were down */
+
+#ifdef WINDOWS
+    HANDLE h[2];
+    h[0] = stop_event;
+    h[1] = FindFirstChangeNotificationA(import_dir, FALSE,
+                                        FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE);
+    if (INVALID_HANDLE_VALUE == h[1]) {
+        log_msg("import: can't watch '%s'", import_dir);
+        return NULL;
+    }
+
+    for (;;) {
+        DWORD res = WaitForMultipleObjects(2, h, FALSE, n_incomplete ? RETRY_MS : INFINITE);
+        if (WAIT_OBJECT_0 == res)
+            break;
+
+        if (WAIT_OBJECT_0 + 1 == res)
+            FindNextChangeNotification(h[1]);
+        n_incomplete = scan_dir();
+    }
+
+    FindCloseChangeNotification(h[1]);
+#else
+    struct pollfd pfd[2];
+
+    pfd[0].fd = stop_pipe[0];
+    pfd[0].events = POLLIN;
+
+#ifdef LIN
+    /* files are complete when closed after writing or moved in */
+    int fd = inotify_init();
+    if (fd < 0 || inotify_add_watch(fd, import_dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log_msg("import: can't watch '%s'", import_dir);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    pfd[1].fd = fd;
+    pfd[1].events = POLLIN;
+    n_incomplete = 0;   /* a partial file comes with another event */
+#else
+    /* kqueue reports directory entry changes, not writes into a new file */
+    int dir_fd = open(import_dir, O_RDONLY);
+    int fd = kqueue();
+    if (dir_fd < 0 || fd < 0) {
+        log_msg("import: can't watch '%s'", import_dir);
+        if (dir_fd >= 0) close(dir_fd);
+        if (fd >= 0) close(fd);
+        return NULL;
+    }
+
+    struct kevent kev;
+    EV_SET(&kev, dir_fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND, 0, NULL);
+    kevent(fd, &kev, 1, NULL, 0, NULL);
+
+    pfd[1].fd = fd;
+    pfd[1].events = POLLIN;
+#endif
+
+    for (;;) {
+        int res = poll(pfd, 2, n_incomplete ? RETRY_MS : -1);
+        if (res < 0 || (pfd[0].revents & POLLIN))
+            break;
+
+        if (pfd[1].revents & POLLIN) {
+#ifdef LIN
+            char buf[4096];
+            if (read(fd, buf, sizeof(buf)) < 0)
+                break;
+#else
+            struct timespec ts = { 0, 0 };
+            kevent(fd, NULL, 0, &kev, 1, &ts);
+#endif
+        }
+
+        n_incomplete = scan_dir();
+#ifdef LIN
+        n_incomplete = 0;
+#endif
+    }
+
+    close(fd);
+#ifndef LIN
+    close(dir_fd);
+#endif
+#endif
+
+    return NULL;
+}
+
+/* start watching dir, it must end with the separator, return success == 1 */
+int
+tlasxp_import_start(const char *dir)
+{
+    if (running)
+        return 1;
+
+    snprintf(import_dir, sizeof(import_dir), "%s", dir);
+
+#ifdef WINDOWS
+    CreateDirectoryA(import_dir, NULL);
+    if (NULL == (stop_event = CreateEvent(NULL, TRUE, FALSE, NULL))) {
+        log_msg("import: can't create stop event");
+        return 0;
+    }
+#else
+    mkdir(import_dir, 0755);
+    if (pipe(stop_pipe)) {
+        log_msg("import: can't create stop pipe");
+        return 0;
+    }
+#endif
+
+    if (pthread_create(&watcher, NULL, watcher_main, NULL)) {
+        log_msg("import: can't create watcher thread");
+        tlasxp_import_stop();
+        return 0;
+    }
+
+    running = 1;
+    log_msg("import: watching '%s'", import_dir);
+    return 1;
+}
+
+void
+tlasxp_import_stop(void)
+{
+#ifdef WINDOWS
+    if (running) {
+        SetEvent(stop_event);
+        pthread_join(watcher, NULL);
+    }
+
+    if (stop_event)
+        CloseHandle(stop_event);
+    stop_event = NULL;
+#else
+    if (running) {
+        if (write(stop_pipe[1], "x", 1) < 0)
+            log_msg("import: can't signal watcher");
+        pthread_join(watcher, NULL);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        if (stop_pipe[i] >= 0)
+            close(stop_pipe[i]);
+        stop_pipe[i] = -1;
+    }
+#endif
+
+    running = 0;
+
+    pthread_mutex_lock(&import_mutex);
+    free(pending);
+    pending = NULL;
+    have_pending = 0;
+    pthread_mutex_unlock(&import_mutex);
+}
+
+/* the imported xml if there is one, 0 terminated and to be freed by the caller */
+char *
+tlasxp_import_take(int *len)
+{
+    /* cheap enough to be called every frame */
+    if (! __atomic_load_n(&have_pending, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    pthread_mutex_lock(&import_mutex);
+    char *xml = pending;
+    *len = pending_len;
+    pending = NULL;
+    have_pending = 0;
+    pthread_mutex_unlock(&import_mutex);
+    return xml;
+}
+
+static int
+fms_type(const navlog_fix_t *fix)
+{
+    if (0 == strcmp(fix->type, "apt")) return 1;
+    if (0 == strcmp(fix->type, "ndb")) return 2;
+    if (0 == strcmp(fix->type, "vor")) return 3;
+    if (0 == strcmp(fix->type, "ltlg")) return 28;
+    return 11;
+}
+
+/* write an X-Plane 11 FMS plan for the OFP's navlog, return success == 1 */
+int
+tlasxp_import_fms(const ofp_info_t *oi, const char *fn)
+{
+    const navlog_fix_t *nl = oi->navlog;
+    int n = oi->n_navlog;
+    float lat[2] = { oi->origin_lat, oi->destination_lat };
+    float lon[2] = { oi->origin_lon, oi->destination_lon };
+    int elev[2] = { oi->origin_elev, oi->destination_elev };
+
+    /*
+     * The airports may or may not be part of the navlog. Their positions come from
+     * the OFP's airport sections, the navlog is the fallback for OFPs without.
+     */
+    if (n > 0 && 0 == strcmp(nl[0].ident, oi->origin)) {
+        if (0.0f == lat[0] && 0.0f == lon[0]) {
+            lat[0] = nl[0].lat; lon[0] = nl[0].lon; elev[0] = nl[0].altitude;
+        }
+        nl++; n--;
+    }
+
+    if (n > 0 && 0 == strcmp(nl[n - 1].ident, oi->destination)) {
+        if (0.0f == lat[1] && 0.0f == lon[1]) {
+            lat[1] = nl[n - 1].lat; lon[1] = nl[n - 1].lon; elev[1] = nl[n - 1].altitude;
+        }
+        n--;
+    }
+
+    int n_enr = 2;
+    for (int i = 0; i < n; i++)
+        if (strcmp(nl[i].ident, "TOC") && strcmp(nl[i].ident, "TOD"))
+            n_enr++;
+
+    FILE *f = fopen(fn, "wb");
+    if (NULL == f) {
+        log_msg("Can't create file '%s'", fn);
+        return 0;
+    }
+
+    fprintf(f, "I\n1100 Version\nCYCLE %s\n", oi->airac[0] ? oi->airac : "0000");
+    fprintf(f, "ADEP %s\n", oi->origin);
+    if (oi->origin_rwy[0])
+        fprintf(f, "DEPRWY RW%s\n", oi->origin_rwy);
+    fprintf(f, "ADES %s\n", oi->destination);
+    if (oi->destination_rwy[0])
+        fprintf(f, "DESRWY RW%s\n", oi->destination_rwy);
+    fprintf(f, "NUMENR %d\n", n_enr);
+
+    fprintf(f, "1 %s ADEP %d.000000 %0.6f %0.6f\n", oi->origin, elev[0], lat[0], lon[0]);
+    for (int i = 0; i < n; i++) {
+        if (0 == strcmp(nl[i].ident, "TOC") || 0 == strcmp(nl[i].ident, "TOD"))
+            continue;
+        fprintf(f, "%d %s DRCT %d.000000 %0.6f %0.6f\n", fms_type(&nl[i]), nl[i].ident,
+                nl[i].altitude, nl[i].lat, nl[i].lon);
+    }
+    fprintf(f, "1 %s ADES %d.000000 %0.6f %0.6f\n", oi->destination, elev[1], lat[1], lon[1]);
+
+    int res = ! ferror(f);
+    fclose(f);
+    return res;
+}
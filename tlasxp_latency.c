@@ -0,0 +1,266 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Per endpoint latency histograms and the timeouts derived from them.
+ *
+ * For each class of endpoint the time to first byte and the total time of
+ * successful requests are kept in log spaced histograms. Once there are
+ * enough samples the timeouts are a margin times the p99, clamped to the
+ * policy's floor and ceiling, so a dead link is detected quickly on a fast
+ * network and a slow one still succeeds. They replace the caller's timeout
+ * and are bounded by the deadline of the whole run only.
+ * The histograms are persisted across sessions.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define LAT_MAGIC 0x544c4131       /* "TLA1" */
+#define N_BUCKETS 24
+#define BUCKET_0 0.01               /* s, upper edge of the first bucket */
+#define BUCKET_F 1.5                /* ratio of consecutive edges */
+#define MIN_SAMPLES 20
+#define MAX_COUNT 2000              /* counts are halved beyond that so the histograms age */
+
+#define MIN(x, y) (((x) < (y)) ? (x) : (y))
+
+typedef struct _histo
+{
+    uint32_t n;
+    uint32_t count[N_BUCKETS];
+} histo_t;
+
+typedef struct _lat_file
+{
+    uint32_t magic;
+    uint32_t n_ep;
+    histo_t ttfb[LAT_N_EP];
+    histo_t total[LAT_N_EP];
+} lat_file_t;
+
+/* floors and ceilings in s */
+latency_policy_t tlasxp_latency_policy[LAT_N_EP] =
+{
+    [LAT_SB_API] = { .margin = 2.0, .ttfb_floor = 2.0, .ttfb_ceil = 15.0, .total_floor = 3.0, .total_ceil = 20.0 },
+    [LAT_SB_FMS] = { .margin = 2.0, .ttfb_floor = 1.0, .ttfb_ceil = 10.0, .total_floor = 2.0, .total_ceil = 15.0 },
+    [LAT_SB_ASSET] = { .margin = 2.0, .ttfb_floor = 1.0, .ttfb_ceil = 10.0, .total_floor = 3.0, .total_ceil = 60.0 },
+    [LAT_ASXP_PROBE] = { .margin = 3.0, .ttfb_floor = 0.1, .ttfb_ceil = 1.0, .total_floor = 0.2, .total_ceil = 1.0 },
+    [LAT_ASXP_WX] = { .margin = 3.0, .ttfb_floor = 0.2, .ttfb_ceil = 3.0, .total_floor = 0.3, .total_ceil = 5.0 },
+    [LAT_ASXP_LOAD] = { .margin = 3.0, .ttfb_floor = 0.5, .ttfb_ceil = 5.0, .total_floor = 0.5, .total_ceil = 8.0 },
+    [LAT_OTHER]  = { .margin = 2.0, .ttfb_floor = 1.0, .ttfb_ceil = 10.0, .total_floor = 1.0, .total_ceil = 20.0 },
+};
+
+static const char *ep_names[LAT_N_EP] = {
+    "sb api", "sb fms", "sb asset", "asxp probe", "asxp wx", "asxp load", "other"
+};
+
+static pthread_mutex_t lat_mutex = PTHREAD_MUTEX_INITIALIZER;
+static lat_file_t lat;
+static char lat_fn[600];
+
+/* the endpoint class of url, a liveness probe of ASXP and a big PDF must not share a histogram */
+int
+tlasxp_latency_ep(const char *url)
+{
+    if (0 == strncmp(url, ASXP_URL, strlen(ASXP_URL))) {
+        const char *path = url + strlen(ASXP_URL);
+        if (strstr(path, "/GetWeatherInfoXml"))
+            return LAT_ASXP_WX;
+        if (strstr(path, "/LoadFlightPlan"))
+            return LAT_ASXP_LOAD;
+        return LAT_ASXP_PROBE;
+    }
+
+    if (strstr(url, "simbrief.com/api/"))
+        return LAT_SB_API;
+
+    if (strstr(url, "simbrief.com/")) {
+        const char *ext = strrchr(url, '.');
+        return (ext && 0 == strcmp(ext, ".fms")) ? LAT_SB_FMS : LAT_SB_ASSET;
+    }
+
+    return LAT_OTHER;
+}
+
+static void
+histo_add(histo_t *h, double t)
+{
+    int b = 0;
+    for (double edge = BUCKET_0; t > edge && b < N_BUCKETS - 1; edge *= BUCKET_F)
+        b++;
+
+    if (h->n >= MAX_COUNT) {
+        h->n = 0;
+        for (int i = 0; i < N_BUCKETS; i++) {
+            h->count[i] /= 2;
+            h->n += h->count[i];
+        }
+    }
+
+    h->count[b]++;
+    h->n++;
+}
+
+/* upper bucket edge of the p quantile, 0 if there are not enough samples */
+static double
+histo_quantile(const histo_t *h, double p)
+{
+    if (h->n < MIN_SAMPLES)
+        return 0.0;
+
+    uint32_t sum = 0;
+    double edge = BUCKET_0;
+    for (int i = 0; i < N_BUCKETS - 1; i++) {
+        sum += h->count[i];
+        if (sum >= p * h->n)
+            break;
+        edge *= BUCKET_F;
+    }
+
+    return edge;
+}
+
+static double
+clamp(double x, double lo, double hi)
+{
+    return (x < lo) ? lo : ((x > hi) ? hi : x);
+}
+
+/*
+ * A successful request. A request that timed out is added with twice its
+ * elapsed time so too tight timeouts widen quickly.
+ */
+void
+tlasxp_latency_add(int ep, double ttfb, double total, int timed_out)
+{
+    pthread_mutex_lock(&lat_mutex);
+    if (timed_out) {
+        histo_add(&lat.ttfb[ep], 2.0 * total);
+        histo_add(&lat.total[ep], 2.0 * total);
+    } else {
+        if (ttfb > 0.0)
+            histo_add(&lat.ttfb[ep], ttfb);
+        histo_add(&lat.total[ep], total);
+    }
+    pthread_mutex_unlock(&lat_mutex);
+}
+
+/*
+ * Derive the timeouts for a request to ep. Without enough samples the
+ * caller's timeout is used and there is no separate first byte timeout.
+ * Returns the total timeout, *ttfb_timeout is 0 if there is none.
+ */
+double
+tlasxp_latency_timeout(int ep, double timeout, double *ttfb_timeout)
+{
+    const latency_policy_t *pol = &tlasxp_latency_policy[ep];
+
+    pthread_mutex_lock(&lat_mutex);
+    double p99_ttfb = histo_quantile(&lat.ttfb[ep], 0.99);
+    double p99_total = histo_quantile(&lat.total[ep], 0.99);
+    pthread_mutex_unlock(&lat_mutex);
+
+    if (p99_total > 0.0)
+        timeout = clamp(pol->margin * p99_total, pol->total_floor, pol->total_ceil);
+
+    *ttfb_timeout = 0.0;
+    if (p99_ttfb > 0.0)
+        *ttfb_timeout = MIN(timeout, clamp(pol->margin * p99_ttfb, pol->ttfb_floor, pol->ttfb_ceil));
+
+    return timeout;
+}
+
+/* load persisted histograms from fn, later saved to the same file */
+void
+tlasxp_latency_init(const char *fn)
+{
+    snprintf(lat_fn, sizeof(lat_fn), "%s", fn);
+
+    FILE *f = fopen(lat_fn, "rb");
+    if (NULL == f)
+        return;
+
+    lat_file_t lf;
+    int ok = (1 == fread(&lf, sizeof(lf), 1, f));
+    fclose(f);
+
+    if (ok && LAT_MAGIC == lf.magic && LAT_N_EP == lf.n_ep) {
+        pthread_mutex_lock(&lat_mutex);
+        lat = lf;
+        pthread_mutex_unlock(&lat_mutex);
+        log_msg("latency histograms loaded from '%s'", lat_fn);
+    }
+}
+
+void
+tlasxp_latency_save(void)
+{
+    if (0 == lat_fn[0])
+        return;
+
+    char tmp_fn[610];
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", lat_fn);
+
+    pthread_mutex_lock(&lat_mutex);
+    lat.magic = LAT_MAGIC;
+    lat.n_ep = LAT_N_EP;
+    lat_file_t lf = lat;
+    pthread_mutex_unlock(&lat_mutex);
+
+    FILE *f = fopen(tmp_fn, "wb");
+    if (NULL == f)
+        return;
+
+    int ok = (1 == fwrite(&lf, sizeof(lf), 1, f));
+    ok &= (0 == fclose(f));
+    if (! (ok && tlasxp_replace_file(tmp_fn, lat_fn))) {
+        log_msg("Can't save latency histograms to '%s'", lat_fn);
+        remove(tmp_fn);
+    }
+}
+
+void
+tlasxp_latency_log(void)
+{
+    for (int ep = 0; ep < LAT_N_EP; ep++) {
+        double ttfb_timeout;
+        double timeout = tlasxp_latency_timeout(ep, tlasxp_latency_policy[ep].total_ceil, &ttfb_timeout);
+
+        pthread_mutex_lock(&lat_mutex);
+        int n = lat.total[ep].n;
+        double p50 = histo_quantile(&lat.total[ep], 0.5);
+        double p99 = histo_quantile(&lat.total[ep], 0.99);
+        pthread_mutex_unlock(&lat_mutex);
+
+        if (n > 0)
+            log_msg("latency %s: n: %d, total p50: %0.2f s, p99: %0.2f s, timeouts: first byte: %0.2f s, total: %0.2f s",
+                    ep_names[ep], n, p50, p99, ttfb_timeout, timeout);
+    }
+}
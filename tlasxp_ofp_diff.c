@@ -0,0 +1,151 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Structural diff of two parsed OFPs.
+ *
+ * A revised plan usually changes only a few things, e.g. the alternate or the
+ * fuel. The diff result is a mask of changed field groups so callers can run
+ * only the downstream actions that are affected.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "tlasxp.h"
+
+typedef struct _diff_field
+{
+    size_t ofs;
+    unsigned mask;
+} diff_field_t;
+
+#define F(field, mask) { offsetof(ofp_info_t, field), mask }
+
+static const diff_field_t diff_fields[] = {
+    F(icao_airline, OFP_CHG_FLIGHT),
+    F(flight_number, OFP_CHG_FLIGHT),
+    F(aircraft_icao, OFP_CHG_FLIGHT),
+    F(origin, OFP_CHG_AIRPORTS),
+    F(destination, OFP_CHG_AIRPORTS),
+    F(origin_rwy, OFP_CHG_RWY),
+    F(destination_rwy, OFP_CHG_RWY),
+    F(alternate, OFP_CHG_ALTN),
+    F(alt_route, OFP_CHG_ALTN),
+    F(route, OFP_CHG_ROUTE),
+    F(altitude, OFP_CHG_CRZ),
+    F(tropopause, OFP_CHG_CRZ),
+    F(isa_dev, OFP_CHG_CRZ),
+    F(wind_component, OFP_CHG_CRZ),
+    F(units, OFP_CHG_FUEL | OFP_CHG_WEIGHTS),
+    F(fuel_plan_ramp, OFP_CHG_FUEL),
+    F(pax_count, OFP_CHG_WEIGHTS),
+    F(pax_weight, OFP_CHG_WEIGHTS),
+    F(payload, OFP_CHG_WEIGHTS),
+    F(est_zfw, OFP_CHG_WEIGHTS),
+    F(est_time_enroute, OFP_CHG_TIMES),
+};
+
+#undef F
+
+static const char *chg_names[] = {
+    "flight", "airports", "runways", "alternate", "route", "cruise", "fuel", "weights", "times"
+};
+
+/* navlog level diff, 0.001° is ~ 100 m */
+static unsigned
+diff_navlog(const ofp_info_t *o, const ofp_info_t *n, int *n_fixes)
+{
+    unsigned mask = 0;
+
+    int nf = (o->n_navlog < n->n_navlog) ? o->n_navlog : n->n_navlog;
+    *n_fixes = abs(o->n_navlog - n->n_navlog);
+
+    for (int i = 0; i < nf; i++) {
+        const navlog_fix_t *a = &o->navlog[i], *b = &n->navlog[i];
+        if (strcmp(a->ident, b->ident) || fabsf(a->lat - b->lat) > 0.001f
+            || fabsf(a->lon - b->lon) > 0.001f) {
+            (*n_fixes)++;
+            mask |= OFP_CHG_ROUTE;
+        } else if (a->altitude != b->altitude) {
+            mask |= OFP_CHG_CRZ;
+        }
+    }
+
+    if (*n_fixes > 0)
+        mask |= OFP_CHG_ROUTE;
+
+    return mask;
+}
+
+/*
+ * Compare the previous OFP o with the new OFP n.
+ * Returns the mask of changed field groups, OFP_CHG_ALL if there is nothing to
+ * compare with, and a human readable summary in summary.
+ */
+unsigned
+tlasxp_ofp_diff(const ofp_info_t *o, const ofp_info_t *n, char *summary, int len)
+{
+    if (! o->valid || ! n->valid) {
+        snprintf(summary, len, "New OFP");
+        return OFP_CHG_ALL;
+    }
+
+    unsigned mask = 0;
+    for (int i = 0; i < (int)(sizeof(diff_fields) / sizeof(diff_fields[0])); i++) {
+        const diff_field_t *df = &diff_fields[i];
+        if (strcmp((const char *)o + df->ofs, (const char *)n + df->ofs))
+            mask |= df->mask;
+    }
+
+    int n_fixes;
+    mask |= diff_navlog(o, n, &n_fixes);
+
+    /* the unused part of the grid is zero */
+    if (memcmp(&o->wind, &n->wind, sizeof(o->wind)))
+        mask |= OFP_CHG_CRZ;
+
+    if (0 == mask) {
+        snprintf(summary, len, "OFP unchanged");
+        return 0;
+    }
+
+    int l = snprintf(summary, len, "Changed:");
+    const char *sep = " ";
+    for (int i = 0; i < (int)(sizeof(chg_names) / sizeof(chg_names[0])) && l < len; i++) {
+        if (mask & (1 << i)) {
+            l += snprintf(summary + l, len - l, "%s%s", sep, chg_names[i]);
+            sep = ", ";
+        }
+    }
+
+    if (n_fixes > 0 && l < len)
+        snprintf(summary + l, len - l, " (navlog fixes: %d)", n_fixes);
+
+    log_msg("ofp diff: mask: 0x%03x, %s", mask, summary);
+    return mask;
+}
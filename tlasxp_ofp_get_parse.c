@@ -57,6 +57,16 @@ tlasxp_dump_ofp_info(ofp_info_t *ofp_info)
         L(sb_path);
         L(sb_fms_link);
         L(time_generated);
+        L(airac);
+        L(fuel_plan_ramp);
+        L(pax_count);
+        L(pax_weight);
+        L(payload);
+        L(est_zfw);
+        log_msg("navlog: %d fixes", ofp_info->n_navlog);
+        log_msg("wind grid: %d rows x %d levels", ofp_info->wind.n_rows, ofp_info->wind.n_levels);
+        for (int i = 0; i < ofp_info->n_assets; i++)
+            log_msg("asset: %s: %s", ofp_info->assets[i].name, ofp_info->assets[i].url);
     } else {
         log_msg(ofp_info->status);
     }
@@ -70,16 +80,17 @@ get_element_text(char *xml, int start_ofs, int end_ofs, const char *tag, int *te
     sprintf(stag, "<%s>", tag);
     sprintf(etag, "</%s>", tag);
 
-    char *s = strstr(xml + start_ofs, stag);
-    if (NULL == s)
-        return 0;
-
-    s += strlen(stag);
-
     /* don't run over end_ofs */
     int c = xml[end_ofs];
     xml[end_ofs] = '\0';
-    char *e = strstr(s, etag);
+
+    char *e = NULL;
+    char *s = strstr(xml + start_ofs, stag);
+    if (s) {
+        s += strlen(stag);
+        e = strstr(s, etag);
+    }
+
     xml[end_ofs] = c;
 
     if (NULL == e)
@@ -90,57 +101,155 @@ get_element_text(char *xml, int start_ofs, int end_ofs, const char *tag, int *te
     return 1;
 }
 
-#define POSITION(tag) \
-get_element_text(ofp, 0, ofp_len, tag, &out_s, &out_e)
-
-#define EXTRACT(tag, field) \
-do { \
-    int s, e; \
-    if (get_element_text(ofp, out_s, out_e, tag, &s, &e)) { \
-        strncpy(ofp_info->field, ofp + s, MIN(sizeof(ofp_info->field), e - s)); \
-    } \
-} while (0)
-
-int
-tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info)
+/* copy text of element 'tag' as a 0 terminated string */
+static int
+copy_element_text(char *xml, int start_ofs, int end_ofs, const char *tag, char *buf, int buf_len)
 {
-    char *ofp = NULL;
-    FILE *f = NULL;
+    int s, e;
 
-    memset(ofp_info, 0, sizeof(*ofp_info));
-    int ofp_len;
+    buf[0] = '\0';
+    if (! get_element_text(xml, start_ofs, end_ofs, tag, &s, &e))
+        return 0;
 
-    char url[100];
-    sprintf(url, "https://www.simbrief.com/api/xml.fetcher.php?userid=%s", pilot_id);
-    // log_msg(url);
+    int len = MIN(buf_len - 1, e - s);
+    memcpy(buf, xml + s, len);
+    buf[len] = '\0';
+    return 1;
+}
 
-    f = fopen(tlasxp_tmp_fn, "wb+");
-    // is unrealiable on windows FILE *f = tmpfile();
+/* the <level>s of a fix's <wind_data>, ascending altitude */
+static int
+parse_wind_data(char *ofp, int start_ofs, int end_ofs, wind_level_t *levels)
+{
+    int ws, we, ls, le;
+    char buf[20];
+    int n = 0;
 
-    if (NULL == f) {
-        log_msg("Can't create temporary file");
+    if (! get_element_text(ofp, start_ofs, end_ofs, "wind_data", &ws, &we))
         return 0;
+
+    while (n < WIND_MAX_LEVELS && get_element_text(ofp, ws, we, "level", &ls, &le)) {
+        wind_level_t *lv = &levels[n];
+        copy_element_text(ofp, ls, le, "altitude", buf, sizeof(buf));
+        lv->altitude = atoi(buf);
+        copy_element_text(ofp, ls, le, "wind_dir", buf, sizeof(buf));
+        lv->dir = atoi(buf);
+        copy_element_text(ofp, ls, le, "wind_spd", buf, sizeof(buf));
+        lv->spd = atoi(buf);
+        copy_element_text(ofp, ls, le, "oat", buf, sizeof(buf));
+        lv->oat = atoi(buf);
+
+        /* keep it sorted */
+        for (int i = n; i > 0 && levels[i - 1].altitude > levels[i].altitude; i--) {
+            wind_level_t t = levels[i];
+            levels[i] = levels[i - 1];
+            levels[i - 1] = t;
+        }
+
+        n++;
+        ws = le;
     }
 
-    int res = tlasxp_http_get(url, f, &ofp_len, 10);
+    return n;
+}
 
-    if (0 == res) {
-        strcpy(ofp_info->status, "Network error");
-        goto out;
+static void
+parse_navlog(char *ofp, int start_ofs, int end_ofs, ofp_info_t *ofp_info, arena_t *arena)
+{
+    int fs, fe;
+    int ofs = start_ofs;
+    int distance = 0;
+    char buf[20];
+
+    /* winds of all fixes for tlasxp_wind_build() */
+    int *dist = tlasxp_arena_alloc(arena, MAX_NAVLOG * sizeof(int));
+    int *n_levels = tlasxp_arena_alloc(arena, MAX_NAVLOG * sizeof(int));
+    wind_level_t *levels = tlasxp_arena_alloc(arena, MAX_NAVLOG * WIND_MAX_LEVELS * sizeof(wind_level_t));
+
+    while (ofp_info->n_navlog < MAX_NAVLOG
+           && get_element_text(ofp, ofs, end_ofs, "fix", &fs, &fe)) {
+        int i = ofp_info->n_navlog++;
+        navlog_fix_t *fix = &ofp_info->navlog[i];
+
+        copy_element_text(ofp, fs, fe, "ident", fix->ident, sizeof(fix->ident));
+        copy_element_text(ofp, fs, fe, "type", fix->type, sizeof(fix->type));
+        copy_element_text(ofp, fs, fe, "pos_lat", buf, sizeof(buf));
+        fix->lat = atof(buf);
+        copy_element_text(ofp, fs, fe, "pos_long", buf, sizeof(buf));
+        fix->lon = atof(buf);
+        copy_element_text(ofp, fs, fe, "altitude_feet", buf, sizeof(buf));
+        fix->altitude = atoi(buf);
+        copy_element_text(ofp, fs, fe, "distance", buf, sizeof(buf));   /* of the leg */
+        distance += atoi(buf);
+        fix->distance = distance;
+
+        if (levels) {
+            dist[i] = distance;
+            n_levels[i] = parse_wind_data(ofp, fs, fe, &levels[i * WIND_MAX_LEVELS]);
+        }
+
+        ofs = fe;
     }
 
-    log_msg("got ofp %d bytes", ofp_len);
-    rewind(f);
+    if (levels && ofp_info->n_navlog > 0)
+        tlasxp_wind_build(&ofp_info->wind, dist, levels, n_levels, ofp_info->n_navlog);
+}
 
-    if (NULL == (ofp = malloc(ofp_len+1))) {    /* + space for a terminating 0 */
-        log_msg("can't malloc OFP xml buffer");
-        res = 0;
-        goto out;
+/* reference point and elevation of the airport section */
+static void
+parse_airport(char *ofp, int start_ofs, int end_ofs, float *lat, float *lon, int *elev)
+{
+    char buf[20];
+
+    copy_element_text(ofp, start_ofs, end_ofs, "pos_lat", buf, sizeof(buf));
+    *lat = atof(buf);
+    copy_element_text(ofp, start_ofs, end_ofs, "pos_long", buf, sizeof(buf));
+    *lon = atof(buf);
+    copy_element_text(ofp, start_ofs, end_ofs, "elevation", buf, sizeof(buf));
+    *elev = atoi(buf);
+}
+
+/* collect the <name>, <link> pairs below the section's <directory> */
+static void
+parse_assets(char *ofp, int start_ofs, int end_ofs, ofp_info_t *ofp_info)
+{
+    char dir[200];
+    int ns, ne, ls, le;
+    int ofs = start_ofs;
+
+    copy_element_text(ofp, start_ofs, end_ofs, "directory", dir, sizeof(dir));
+
+    while (ofp_info->n_assets < MAX_ASSETS
+           && get_element_text(ofp, ofs, end_ofs, "name", &ns, &ne)
+           && get_element_text(ofp, ne, end_ofs, "link", &ls, &le)) {
+        ofp_asset_t *a = &ofp_info->assets[ofp_info->n_assets++];
+        snprintf(a->name, sizeof(a->name), "%.*s", ne - ns, ofp + ns);
+        snprintf(a->url, sizeof(a->url), "%s%.*s", dir, le - ls, ofp + ls);
+        ofs = le;
     }
+}
 
-    ofp_len = fread(ofp, 1, ofp_len, f);
-    res = 1;
-    ofp[ofp_len] = '\0';
+#define POSITION(tag) \
+get_element_text(ofp, 0, ofp_len, tag, &out_s, &out_e)
+
+#define EXTRACT(tag, field) \
+do { \
+    int s, e; \
+    if (get_element_text(ofp, out_s, out_e, tag, &s, &e)) { \
+        strncpy(ofp_info->field, ofp + s, MIN(sizeof(ofp_info->field), e - s)); \
+    } \
+} while (0)
+
+/*
+ * Parse the OFP xml in ofp, it must be 0 terminated and is modified temporarily.
+ * Network independent, also used for imported OFPs. Return success == 1, a
+ * SimBrief error is a success with the message in status.
+ * Work buffers come from the fetch's arena, the caller releases it.
+ */
+int
+tlasxp_ofp_parse(char *ofp, int ofp_len, ofp_info_t *ofp_info, arena_t *arena)
+{
+    memset(ofp_info, 0, sizeof(*ofp_info));
 
     int out_s, out_e;
     if (POSITION("fetch")) {
@@ -153,6 +262,7 @@ tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info)
     if (POSITION("params")) {
         EXTRACT("time_generated", time_generated);
         EXTRACT("units", units);
+        EXTRACT("airac", airac);
     }
 
     if (POSITION("aircraft")) {
@@ -162,11 +272,15 @@ tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info)
     if (POSITION("origin")) {
         EXTRACT("icao_code", origin);
         EXTRACT("plan_rwy", origin_rwy);
+        parse_airport(ofp, out_s, out_e, &ofp_info->origin_lat, &ofp_info->origin_lon,
+                      &ofp_info->origin_elev);
     }
 
     if (POSITION("destination")) {
         EXTRACT("icao_code", destination);
         EXTRACT("plan_rwy", destination_rwy);
+        parse_airport(ofp, out_s, out_e, &ofp_info->destination_lat, &ofp_info->destination_lon,
+                      &ofp_info->destination_elev);
      }
 
     if (POSITION("general")) {
@@ -184,12 +298,36 @@ tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info)
         EXTRACT("route", alt_route);
     }
 
+    if (POSITION("fuel")) {
+        EXTRACT("plan_ramp", fuel_plan_ramp);
+    }
+
+    if (POSITION("weights")) {
+        EXTRACT("pax_count", pax_count);
+        EXTRACT("pax_weight", pax_weight);
+        EXTRACT("payload", payload);
+        EXTRACT("est_zfw", est_zfw);
+    }
+
     if (POSITION("times")) {
         EXTRACT("est_time_enroute", est_time_enroute);
     }
 
+    if (POSITION("navlog")) {
+        parse_navlog(ofp, out_s, out_e, ofp_info, arena);
+    }
+
     if (POSITION("fms_downloads")) {
         EXTRACT("directory", sb_path);
+        parse_assets(ofp, out_s, out_e, ofp_info);
+    }
+
+    if (POSITION("files")) {
+        parse_assets(ofp, out_s, out_e, ofp_info);
+    }
+
+    if (POSITION("images")) {
+        parse_assets(ofp, out_s, out_e, ofp_info);
     }
 
     /* beware: these go directly into nested structures that fortunately
@@ -200,8 +338,63 @@ tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info)
     }
 
 out:
-    if (ofp) free(ofp);
+    return 1;
+}
+
+/* SimBrief's share of the run's deadline, FMS download and ASXP upload get the rest */
+#define OFP_STAGE_SHARE 0.7
+#define OFP_STAGE_CAP 10.0
+
+static int tmp_seq;     /* make temp files unique for concurrent fetches */
+
+int
+tlasxp_ofp_get_parse(const char *pilot_id, ofp_info_t *ofp_info, run_ctl_t *rc, arena_t *arena)
+{
+    char *ofp = NULL;
+    FILE *f = NULL;
+
+    memset(ofp_info, 0, sizeof(*ofp_info));
+    int ofp_len;
+
+    char url[100];
+    sprintf(url, "https://www.simbrief.com/api/xml.fetcher.php?userid=%s", pilot_id);
+    // log_msg(url);
+
+    char tmp_fn[600];
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.%d", tlasxp_tmp_fn,
+             __atomic_add_fetch(&tmp_seq, 1, __ATOMIC_RELAXED));
+    f = fopen(tmp_fn, "wb+");
+    // is unrealiable on windows FILE *f = tmpfile();
+
+    if (NULL == f) {
+        log_msg("Can't create temporary file");
+        return 0;
+    }
+
+    int res = tlasxp_http_get_retry(url, f, &ofp_len, rc,
+                                    tlasxp_stage_timeout(rc, OFP_STAGE_SHARE, OFP_STAGE_CAP));
+
+    if (0 == res) {
+        strcpy(ofp_info->status, rc->canceled ? "Canceled" : "Network error");
+        goto out;
+    }
+
+    log_msg("got ofp %d bytes", ofp_len);
+    rewind(f);
+
+    if (NULL == (ofp = tlasxp_arena_alloc(arena, ofp_len+1))) {    /* + space for a terminating 0 */
+        log_msg("can't allocate OFP xml buffer");
+        res = 0;
+        goto out;
+    }
+
+    ofp_len = fread(ofp, 1, ofp_len, f);
+    ofp[ofp_len] = '\0';
+
+    res = tlasxp_ofp_parse(ofp, ofp_len, ofp_info, arena);
+
+out:
     if (f) fclose(f);
-    unlink(tlasxp_tmp_fn);   /* unchecked */
+    unlink(tmp_fn);   /* unchecked */
     return res;
 }
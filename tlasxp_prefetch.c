@@ -0,0 +1,510 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Background prefetcher for the further downloads of an OFP (PDF, other FMS
+ * formats, maps).
+ *
+ * After a successful fetch the assets are queued and downloaded by a few low
+ * priority workers. Foreground transfers take precedence: while a hold is
+ * active in flight prefetches are aborted and requeued.
+ * Files are stored content addressed as <hash><ext> in a cache directory
+ * with a byte budget and LRU eviction, an index maps urls to blobs.
+ * <cache>current.txt lists "name<TAB>path" of the current OFP's cached assets
+ * so opening the briefing package is a local file read.
+ * Index and manifest are rewritten by the workers: a copy is taken under the
+ * mutex, the files are written outside of it.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifdef WINDOWS
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "tlasxp.h"
+
+#define N_WORKERS 2
+#define MAX_CACHE 256           /* index entries */
+#define ASSET_TIMEOUT 60.0
+#define CACHE_MAGIC 0x54504331  /* "TPC1" */
+
+typedef struct _cache_entry
+{
+    uint64_t url_hash;
+    uint64_t content_hash;
+    uint32_t size;
+    uint32_t pad;
+    int64_t last_use;           /* time() */
+    char ext[8];
+} cache_entry_t;
+
+typedef struct _cache_index
+{
+    uint32_t magic;
+    uint32_t n;
+    cache_entry_t entries[MAX_CACHE];
+} cache_index_t;
+
+enum { JOB_PENDING, JOB_ACTIVE, JOB_DONE, JOB_FAILED };
+
+typedef struct _job
+{
+    ofp_asset_t asset;
+    int state;
+} job_t;
+
+/* what goes to disk, prepared under the mutex */
+typedef struct _persist
+{
+    unsigned seq;
+    size_t idx_len;
+    cache_index_t idx;
+    int man_len;
+    char man[MAX_ASSETS * 700];
+} persist_t;
+
+static pthread_t workers[N_WORKERS];
+static int running;             /* caller's thread only */
+static char cache_dir[600];     /* with trailing separator */
+static size_t cache_budget;
+
+/* the mutex protects all below */
+static pthread_mutex_t pf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pf_cond = PTHREAD_COND_INITIALIZER;
+static int stop_req;
+static int hold;                /* # of active foreground transfers */
+static job_t jobs[MAX_ASSETS];
+static int n_jobs;
+static int generation;          /* bumped with each new job list */
+static run_ctl_t worker_rc[N_WORKERS];
+static int worker_busy[N_WORKERS];
+static cache_index_t cache;
+static int persist_dirty;       /* index or manifest changed */
+static unsigned persist_seq;
+
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned written_seq;    /* io_mutex, newest persist_t on disk */
+
+static uint64_t
+url_hash(const char *url)
+{
+    return tlasxp_hash(url, strlen(url), 0);
+}
+
+static void
+blob_name(const cache_entry_t *e, char *fn, int len)
+{
+    snprintf(fn, len, "%s%016llx%s", cache_dir, (unsigned long long)e->content_hash, e->ext);
+}
+
+/* mutex must be held for all cache_* functions */
+static cache_entry_t *
+cache_find(uint64_t uh)
+{
+    for (uint32_t i = 0; i < cache.n; i++)
+        if (cache.entries[i].url_hash == uh)
+            return &cache.entries[i];
+    return NULL;
+}
+
+/* # of entries referring to the blob of e */
+static int
+cache_refs(const cache_entry_t *e)
+{
+    int n = 0;
+    for (uint32_t i = 0; i < cache.n; i++)
+        n += (cache.entries[i].content_hash == e->content_hash);
+    return n;
+}
+
+/* bytes of all distinct blobs */
+static size_t
+cache_used(void)
+{
+    size_t used = 0;
+    for (uint32_t i = 0; i < cache.n; i++) {
+        uint32_t j;
+        for (j = 0; j < i; j++)
+            if (cache.entries[j].content_hash == cache.entries[i].content_hash)
+                break;
+        if (j == i)
+            used += cache.entries[i].size;
+    }
+
+    return used;
+}
+
+/* drop entry e, its blob is removed with the last reference */
+static void
+cache_drop(cache_entry_t *e)
+{
+    if (1 == cache_refs(e)) {
+        char fn[640];
+        blob_name(e, fn, sizeof(fn));
+        remove(fn);
+    }
+
+    *e = cache.entries[--cache.n];
+}
+
+/* evict least recently used entries until size more bytes and an entry fit */
+static void
+cache_evict(size_t size)
+{
+    while (cache.n > 0 && (cache.n >= MAX_CACHE || cache_used() + size > cache_budget)) {
+        cache_entry_t *lru = &cache.entries[0];
+        for (uint32_t i = 1; i < cache.n; i++)
+            if (cache.entries[i].last_use < lru->last_use)
+                lru = &cache.entries[i];
+
+        log_msg("prefetch: evicting %016llx, %u bytes", (unsigned long long)lru->content_hash, lru->size);
+        cache_drop(lru);
+    }
+}
+
+/* write len bytes of data to fn via a temp file */
+static void
+write_file(const char *fn, const void *data, size_t len)
+{
+    char tmp_fn[630];
+    snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", fn);
+
+    FILE *f = fopen(tmp_fn, "wb");
+    if (NULL == f)
+        return;
+
+    int ok = (0 == len || 1 == fwrite(data, len, 1, f));
+    ok &= (0 == fclose(f));
+    if (! (ok && tlasxp_replace_file(tmp_fn, fn)))
+        remove(tmp_fn);
+}
+
+static void
+cache_load(void)
+{
+    char fn[620];
+    snprintf(fn, sizeof(fn), "%scache.idx", cache_dir);
+
+    memset(&cache, 0, sizeof(cache));
+    FILE *f = fopen(fn, "rb");
+    if (f) {
+        size_t len = fread(&cache, 1, sizeof(cache), f);
+        fclose(f);
+        if (len < offsetof(cache_index_t, entries) || CACHE_MAGIC != cache.magic
+            || len != offsetof(cache_index_t, entries) + cache.n * sizeof(cache_entry_t)) {
+            log_msg("prefetch: cache index '%s' is invalid, starting a new one", fn);
+            memset(&cache, 0, sizeof(cache));
+        }
+    }
+
+    cache.magic = CACHE_MAGIC;
+}
+
+/* mutex must be held, copy the index and list the current OFP's cached assets */
+static void
+persist_prepare(persist_t *p)
+{
+    p->seq = ++persist_seq;
+    p->idx_len = offsetof(cache_index_t, entries) + cache.n * sizeof(cache_entry_t);
+    memcpy(&p->idx, &cache, p->idx_len);
+
+    p->man_len = 0;
+    for (int i = 0; i < n_jobs; i++) {
+        cache_entry_t *e = cache_find(url_hash(jobs[i].asset.url));
+        if (NULL == e)
+            continue;
+
+        char blob[640];
+        blob_name(e, blob, sizeof(blob));
+        int l = snprintf(p->man + p->man_len, sizeof(p->man) - p->man_len, "%s\t%s\n",
+                         jobs[i].asset.name, blob);
+        if (l >= (int)sizeof(p->man) - p->man_len)
+            break;
+        p->man_len += l;
+    }
+
+    persist_dirty = 0;
+}
+
+/* mutex must not be held, a copy older than what is on disk is dropped */
+static void
+persist_write(const persist_t *p)
+{
+    char fn[620];
+
+    pthread_mutex_lock(&io_mutex);
+    if ((int)(p->seq - written_seq) > 0) {
+        snprintf(fn, sizeof(fn), "%scache.idx", cache_dir);
+        write_file(fn, &p->idx, p->idx_len);
+        snprintf(fn, sizeof(fn), "%scurrent.txt", cache_dir);
+        write_file(fn, p->man, p->man_len);
+        written_seq = p->seq;
+    }
+    pthread_mutex_unlock(&io_mutex);
+}
+
+/* download one asset into the cache, return success == 1 */
+static int
+download(const ofp_asset_t *asset, run_ctl_t *rc, int id)
+{
+    char tmp_fn[640];
+    snprintf(tmp_fn, sizeof(tmp_fn), "%sdownload.%d.tmp", cache_dir, id);
+
+    FILE *f = fopen(tmp_fn, "wb");
+    if (NULL == f) {
+        log_msg("prefetch: can't create '%s'", tmp_fn);
+        return 0;
+    }
+
+    int len = 0;
+    int res = tlasxp_http_get(asset->url, f, &len, rc, ASSET_TIMEOUT);
+    res &= (0 == fclose(f));
+
+    cache_entry_t ne;
+    memset(&ne, 0, sizeof(ne));
+    if (! res || ! tlasxp_file_hash(tmp_fn, &ne.content_hash)) {
+        remove(tmp_fn);
+        return 0;
+    }
+
+    ne.url_hash = url_hash(asset->url);
+    ne.size = len;
+    ne.last_use = time(NULL);
+    const char *ext = strrchr(asset->url, '.');
+    if (ext && strlen(ext) < sizeof(ne.ext) && NULL == strchr(ext, '/'))
+        strcpy(ne.ext, ext);
+
+    char blob[640];
+    blob_name(&ne, blob, sizeof(blob));
+
+    pthread_mutex_lock(&pf_mutex);
+
+    cache_entry_t *e = cache_find(ne.url_hash);
+    if (e)
+        cache_drop(e);      /* a new version of the url */
+
+    cache_evict(ne.size);
+
+    /* identical content is stored only once */
+    FILE *bf = fopen(blob, "rb");
+    if (bf) {
+        fclose(bf);
+        remove(tmp_fn);
+    } else if (! tlasxp_replace_file(tmp_fn, blob)) {
+        log_msg("prefetch: can't rename '%s' to '%s'", tmp_fn, blob);
+        remove(tmp_fn);
+        pthread_mutex_unlock(&pf_mutex);
+        return 0;
+    }
+
+    cache.entries[cache.n++] = ne;
+    persist_dirty = 1;
+    pthread_mutex_unlock(&pf_mutex);
+
+    log_msg("prefetch: '%s' cached, %d bytes", asset->name, len);
+    return 1;
+}
+
+static void *
+prefetch_worker(void *arg)
+{
+    int id = (intptr_t)arg;
+    persist_t p;
+
+    pthread_mutex_lock(&pf_mutex);
+
+    while (! stop_req) {
+        if (persist_dirty) {
+            persist_prepare(&p);
+            pthread_mutex_unlock(&pf_mutex);
+            persist_write(&p);
+            pthread_mutex_lock(&pf_mutex);
+            continue;
+        }
+
+        job_t *job = NULL;
+        if (! hold)
+            for (int i = 0; i < n_jobs && NULL == job; i++)
+                if (JOB_PENDING == jobs[i].state)
+                    job = &jobs[i];
+
+        if (NULL == job) {
+            pthread_cond_wait(&pf_cond, &pf_mutex);
+            continue;
+        }
+
+        /* already cached assets are only touched */
+        cache_entry_t *e = cache_find(url_hash(job->asset.url));
+        if (e) {
+            e->last_use = time(NULL);
+            job->state = JOB_DONE;
+            persist_dirty = 1;
+            continue;
+        }
+
+        ofp_asset_t asset = job->asset;
+        int gen = generation;
+        job->state = JOB_ACTIVE;
+        tlasxp_run_init(&worker_rc[id], ASSET_TIMEOUT);
+        worker_busy[id] = 1;
+        pthread_mutex_unlock(&pf_mutex);
+
+        int ok = download(&asset, &worker_rc[id], id);
+
+        pthread_mutex_lock(&pf_mutex);
+        worker_busy[id] = 0;
+        if (gen != generation)      /* job list was replaced meanwhile */
+            continue;
+
+        if (ok) {
+            job->state = JOB_DONE;
+        } else if (worker_rc[id].canceled && ! stop_req) {
+            log_msg("prefetch: '%s' preempted", asset.name);
+            job->state = JOB_PENDING;
+        } else {
+            log_msg("prefetch: '%s' failed", asset.name);
+            job->state = JOB_FAILED;
+        }
+    }
+
+    /* the last word on the way out */
+    int dirty = persist_dirty;
+    if (dirty)
+        persist_prepare(&p);
+    pthread_mutex_unlock(&pf_mutex);
+
+    if (dirty)
+        persist_write(&p);
+    return NULL;
+}
+
+/* mutex must be held */
+static void
+preempt_workers(void)
+{
+    for (int i = 0; i < N_WORKERS; i++)
+        if (worker_busy[i])
+            tlasxp_run_cancel(&worker_rc[i]);
+}
+
+/* dir must end with a separator, return success == 1 */
+int
+tlasxp_prefetch_start(const char *dir, size_t budget)
+{
+    if (running)
+        return 1;
+
+    snprintf(cache_dir, sizeof(cache_dir), "%s", dir);
+    cache_budget = budget;
+
+#ifdef WINDOWS
+    CreateDirectoryA(cache_dir, NULL);
+#else
+    mkdir(cache_dir, 0755);
+#endif
+
+    cache_load();
+    stop_req = 0;
+    hold = 0;
+    n_jobs = 0;
+
+    for (int i = 0; i < N_WORKERS; i++) {
+        if (pthread_create(&workers[i], NULL, prefetch_worker, (void *)(intptr_t)i)) {
+            log_msg("can't create prefetch thread");
+            tlasxp_prefetch_stop();     /* joins the ones already created */
+            return 0;
+        }
+        running = i + 1;
+    }
+
+    return 1;
+}
+
+void
+tlasxp_prefetch_stop(void)
+{
+    if (! running)
+        return;
+
+    pthread_mutex_lock(&pf_mutex);
+    stop_req = 1;
+    preempt_workers();
+    pthread_cond_broadcast(&pf_cond);
+    pthread_mutex_unlock(&pf_mutex);
+
+    for (int i = 0; i < running; i++)
+        pthread_join(workers[i], NULL);
+    running = 0;
+}
+
+/* queue the assets of a new OFP, obsolete prefetches are dropped */
+void
+tlasxp_prefetch_ofp(const ofp_info_t *ofp_info)
+{
+    if (! running)
+        return;
+
+    pthread_mutex_lock(&pf_mutex);
+    generation++;
+    preempt_workers();
+
+    n_jobs = ofp_info->n_assets;
+    for (int i = 0; i < n_jobs; i++) {
+        jobs[i].asset = ofp_info->assets[i];
+        jobs[i].state = JOB_PENDING;
+    }
+
+    persist_dirty = 1;      /* the manifest, written by a worker */
+    pthread_cond_broadcast(&pf_cond);
+    pthread_mutex_unlock(&pf_mutex);
+
+    log_msg("prefetch: %d assets queued", n_jobs);
+}
+
+/* foreground transfers hold off prefetches: on = 1 at their start, on = 0 at their end */
+void
+tlasxp_prefetch_hold(int on)
+{
+    if (! running)
+        return;
+
+    pthread_mutex_lock(&pf_mutex);
+    if (on) {
+        hold++;
+        preempt_workers();
+    } else if (hold > 0 && 0 == --hold) {
+        pthread_cond_broadcast(&pf_cond);
+    }
+    pthread_mutex_unlock(&pf_mutex);
+}
@@ -0,0 +1,338 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Frame cost profiler of the plugin's XP callbacks.
+ *
+ * Everything the plugin does on the sim's main thread enters through a
+ * flight loop, widget, menu, command or message callback. Each callback
+ * is bracketed by tlasxp_prof_begin/end and the time goes into a per probe
+ * log2 histogram of us, along with the worst samples and when they happened.
+ * The costs of all callbacks within one sim cycle add up to the "frame" slot,
+ * that's what the plugin takes away from a frame.
+ * Results are published as datarefs tlasxp/prof/... and a summary is logged
+ * periodically. The fetch arena's stats go along as tlasxp/arena/... Main thread only.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "XPLMDataAccess.h"
+#include "XPLMProcessing.h"
+
+#include "tlasxp.h"
+
+#define UNUSED(x) (void)(x)
+
+#define N_SLOT (PROF_N_PROBE + 1)  /* the last one is the frame total */
+#define SLOT_FRAME PROF_N_PROBE
+#define N_BUCKETS 20                /* bucket i counts samples < 2^i us, the last one all others */
+#define N_WORST 4
+#define LOG_INTERVAL 300.0          /* s */
+
+typedef struct _sample
+{
+    float us;
+    float at;           /* s after init */
+} sample_t;
+
+typedef struct _probe
+{
+    uint32_t calls;
+    double total;       /* us */
+    uint32_t count[N_BUCKETS];
+    sample_t worst[N_WORST];    /* sorted descending */
+} probe_t;
+
+static const char *probe_names[N_SLOT] = {
+    [PROF_FLIGHT_LOOP] = "flight_loop", [PROF_FETCH_POLL] = "fetch_poll",
+    [PROF_XFER_LOOP] = "xfer_loop", [PROF_GETOFP_WIDGET] = "getofp_widget",
+    [PROF_CONF_WIDGET] = "conf_widget", [PROF_SHOW_WIDGET] = "show_widget",
+    [PROF_MENU] = "menu", [PROF_CMD] = "cmd", [PROF_MESSAGE] = "message",
+    [PROF_IMPORT] = "import",
+    [SLOT_FRAME] = "frame"
+};
+
+static probe_t probes[N_SLOT];
+static double t_init, next_log;
+static int depth;                   /* of nested probes, only the outermost count for the frame */
+static int frame_cycle = -1;
+static double frame_us, frame_start;
+
+/* blank separated probe names */
+static char names[N_SLOT * 16];
+static int names_len;
+
+static XPLMDataRef names_dr, calls_dr, avg_dr, p99_dr, max_dr, max_at_dr, hist_dr;
+static XPLMDataRef arena_hw_dr, arena_fb_dr, arena_cap_dr;
+
+static void
+probe_add(probe_t *p, double us, double at)
+{
+    int b = 0;
+    while (b < N_BUCKETS - 1 && us >= (double)(1 << b))
+        b++;
+
+    p->calls++;
+    p->total += us;
+    p->count[b]++;
+
+    if (us <= p->worst[N_WORST - 1].us)
+        return;
+
+    int i = N_WORST - 1;
+    for (; i > 0 && us > p->worst[i - 1].us; i--)
+        p->worst[i] = p->worst[i - 1];
+    p->worst[i].us = us;
+    p->worst[i].at = at;
+}
+
+/* upper bucket edge of the p99 in us, the max is a tighter bound */
+static float
+probe_p99(const probe_t *p)
+{
+    if (0 == p->calls)
+        return 0.0f;
+
+    uint32_t lim = p->calls - p->calls / 100;
+    uint32_t sum = 0;
+    for (int i = 0; i < N_BUCKETS - 1; i++) {
+        sum += p->count[i];
+        if (sum >= lim)
+            return ((float)(1 << i) < p->worst[0].us) ? (float)(1 << i) : p->worst[0].us;
+    }
+
+    return p->worst[0].us;
+}
+
+static void
+log_summary(void)
+{
+    char line[1000];
+    int l = 0;
+
+    for (int i = 0; i < N_SLOT; i++) {
+        const probe_t *p = &probes[i];
+        if (0 == p->calls)
+            continue;
+
+        l += snprintf(line + l, sizeof(line) - l, " %s: n=%u avg=%.0f p99=%.0f max=%.0f@%.0fs;",
+                      probe_names[i], (unsigned)p->calls, p->total / p->calls,
+                      probe_p99(p), p->worst[0].us, p->worst[0].at);
+        if (l >= (int)sizeof(line))
+            break;
+    }
+
+    if (l > 0)
+        log_msg("prof (us):%s", line);
+}
+
+double
+tlasxp_prof_begin(void)
+{
+    depth++;
+    return tlasxp_now();
+}
+
+void
+tlasxp_prof_end(int probe, double t0)
+{
+    double now = tlasxp_now();
+    double us = (now - t0) * 1.0E6;
+    probe_add(&probes[probe], us, t0 - t_init);
+
+    if (--depth > 0)
+        return;
+
+    int cycle = XPLMGetCycleNumber();
+    if (cycle != frame_cycle) {
+        if (frame_cycle >= 0)
+            probe_add(&probes[SLOT_FRAME], frame_us, frame_start - t_init);
+        frame_cycle = cycle;
+        frame_us = 0.0;
+        frame_start = t0;
+    }
+
+    frame_us += us;
+
+    if (now >= next_log) {
+        next_log = now + LOG_INTERVAL;
+        log_summary();
+    }
+}
+
+static int
+get_names(void *ref, void *out, int ofs, int max)
+{
+    UNUSED(ref);
+    if (NULL == out)
+        return names_len;
+
+    if (ofs >= names_len)
+        return 0;
+
+    int n = (names_len - ofs < max) ? names_len - ofs : max;
+    memcpy(out, names + ofs, n);
+    return n;
+}
+
+static int
+get_calls(void *ref, int *out, int ofs, int max)
+{
+    UNUSED(ref);
+    if (NULL == out)
+        return N_SLOT;
+
+    int n = 0;
+    for (int i = ofs; i < N_SLOT && n < max; i++)
+        out[n++] = probes[i].calls;
+    return n;
+}
+
+static int
+get_hist(void *ref, int *out, int ofs, int max)
+{
+    UNUSED(ref);
+    if (NULL == out)
+        return N_SLOT * N_BUCKETS;
+
+    int n = 0;
+    for (int i = ofs; i < N_SLOT * N_BUCKETS && n < max; i++)
+        out[n++] = probes[i / N_BUCKETS].count[i % N_BUCKETS];
+    return n;
+}
+
+/* ref selects the value */
+static int
+get_stat(void *ref, float *out, int ofs, int max)
+{
+    if (NULL == out)
+        return N_SLOT;
+
+    int n = 0;
+    for (int i = ofs; i < N_SLOT && n < max; i++) {
+        const probe_t *p = &probes[i];
+        float v;
+        if (ref == &avg_dr)
+            v = p->calls ? p->total / p->calls : 0.0f;
+        else if (ref == &p99_dr)
+            v = probe_p99(p);
+        else if (ref == &max_dr)
+            v = p->worst[0].us;
+        else
+            v = p->worst[0].at;
+        out[n++] = v;
+    }
+
+    return n;
+}
+
+/* ref selects the value, bytes or count */
+static int
+get_arena(void *ref)
+{
+    if (ref == &arena_hw_dr)
+        return (int)__atomic_load_n(&tlasxp_arena_stats.high_water, __ATOMIC_RELAXED);
+    if (ref == &arena_fb_dr)
+        return __atomic_load_n(&tlasxp_arena_stats.fallbacks, __ATOMIC_RELAXED);
+    return (int)tlasxp_arena_cap;
+}
+
+static XPLMDataRef
+reg_arena(const char *name, void *ref)
+{
+    return XPLMRegisterDataAccessor(name, xplmType_Int, 0,
+                                    get_arena, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                    NULL, NULL, NULL, NULL, ref, NULL);
+}
+
+static XPLMDataRef
+reg_stat(const char *name, void *ref)
+{
+    return XPLMRegisterDataAccessor(name, xplmType_FloatArray, 0,
+                                    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                    get_stat, NULL, NULL, NULL, ref, NULL);
+}
+
+void
+tlasxp_prof_init(void)
+{
+    memset(probes, 0, sizeof(probes));
+    depth = 0;
+    frame_cycle = -1;
+    t_init = tlasxp_now();
+    next_log = t_init + LOG_INTERVAL;
+
+    char *s = names;
+    for (int i = 0; i < N_SLOT; i++)
+        s += sprintf(s, (i > 0) ? " %s" : "%s", probe_names[i]);
+    names_len = s - names;
+
+    names_dr = XPLMRegisterDataAccessor("tlasxp/prof/names", xplmType_Data, 0,
+                                        NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+                                        get_names, NULL, NULL, NULL);
+    calls_dr = XPLMRegisterDataAccessor("tlasxp/prof/calls", xplmType_IntArray, 0,
+                                        NULL, NULL, NULL, NULL, NULL, NULL,
+                                        get_calls, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    hist_dr = XPLMRegisterDataAccessor("tlasxp/prof/hist", xplmType_IntArray, 0,
+                                       NULL, NULL, NULL, NULL, NULL, NULL,
+                                       get_hist, NULL, NULL, NULL, NULL, NULL, NULL, NULL);
+    avg_dr = reg_stat("tlasxp/prof/avg_us", &avg_dr);
+    p99_dr = reg_stat("tlasxp/prof/p99_us", &p99_dr);
+    max_dr = reg_stat("tlasxp/prof/max_us", &max_dr);
+    max_at_dr = reg_stat("tlasxp/prof/max_at", &max_at_dr);
+
+    arena_hw_dr = reg_arena("tlasxp/arena/high_water", &arena_hw_dr);
+    arena_fb_dr = reg_arena("tlasxp/arena/fallbacks", &arena_fb_dr);
+    arena_cap_dr = reg_arena("tlasxp/arena/cap", &arena_cap_dr);
+}
+
+/* log the summary and the worst samples, unregister */
+void
+tlasxp_prof_cleanup(void)
+{
+    log_summary();
+
+    for (int i = 0; i < N_SLOT; i++) {
+        const probe_t *p = &probes[i];
+        if (0 == p->calls)
+            continue;
+
+        char line[200];
+        int l = 0;
+        for (int j = 0; j < N_WORST && p->worst[j].us > 0.0f; j++)
+            l += snprintf(line + l, sizeof(line) - l, " %.0fus@%.1fs", p->worst[j].us, p->worst[j].at);
+        log_msg("prof worst %s:%s", probe_names[i], line);
+    }
+
+    XPLMDataRef *drs[] = { &names_dr, &calls_dr, &hist_dr, &avg_dr, &p99_dr, &max_dr, &max_at_dr,
+                           &arena_hw_dr, &arena_fb_dr, &arena_cap_dr };
+    for (unsigned int i = 0; i < sizeof(drs) / sizeof(drs[0]); i++) {
+        if (*drs[i])
+            XPLMUnregisterDataRef(*drs[i]);
+        *drs[i] = NULL;
+    }
+}
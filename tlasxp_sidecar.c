@@ -0,0 +1,337 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Thin client for the optional fetch daemon tlasxpd.
+ *
+ * The request goes over the daemon's Unix socket, the parsed OFP is picked up
+ * from the daemon's shared memory, the FMS plan from the daemon's directory.
+ * If no daemon is running the caller falls back to fetching in process.
+ * Not available on Windows.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef WINDOWS
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "tlasxp.h"
+
+#define MAX_AGE 10      /* s, a result that old from another instance is good enough */
+
+#ifdef WINDOWS
+int
+tlasxp_sidecar_fetch(const char *pilot_id, ofp_info_t *ofp_info, run_ctl_t *rc)
+{
+    return -1;
+}
+
+int
+tlasxp_sidecar_fms(const char *url, const char *fn, run_ctl_t *rc)
+{
+    return -1;
+}
+
+void
+tlasxp_sidecar_close(void)
+{
+}
+
+#else
+
+static const sidecar_shm_t *shm;
+static dev_t shm_dev;
+static ino_t shm_ino;
+
+/*
+ * socket path and shared memory name of the current user's daemon
+ * The socket is in $XDG_RUNTIME_DIR if there is one, env TLASXPD_SOCK overrides.
+ */
+void
+tlasxp_sidecar_names(char *sock_path, int sock_len, char *shm_name, int shm_len)
+{
+    if (sock_path) {
+        const char *p = getenv("TLASXPD_SOCK");
+        const char *rt = getenv("XDG_RUNTIME_DIR");
+        if (p)
+            snprintf(sock_path, sock_len, "%s", p);
+        else if (rt && rt[0])
+            snprintf(sock_path, sock_len, "%s/tlasxpd.sock", rt);
+        else
+            snprintf(sock_path, sock_len, "/tmp/tlasxpd-%u.sock", (unsigned)getuid());
+    }
+
+    if (shm_name)
+        snprintf(shm_name, shm_len, "/tlasxpd-%u", (unsigned)getuid());
+}
+
+/*
+ * map the daemon's segment, a restarted daemon creates a new one
+ * Only a segment of our own that is large enough and of the same layout
+ * is accepted, so a daemon of another build can't make us read past its end.
+ */
+static int
+map_shm(void)
+{
+    char name[64];
+    struct stat st;
+
+    tlasxp_sidecar_names(NULL, 0, name, sizeof(name));
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return 0;
+
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return 0;
+    }
+
+    if (shm && st.st_dev == shm_dev && st.st_ino == shm_ino) {
+        close(fd);
+        return 1;
+    }
+
+    tlasxp_sidecar_close();
+
+    if (st.st_uid != getuid() || st.st_size < (off_t)sizeof(sidecar_shm_t)) {
+        log_msg("tlasxpd shared memory '%s' is foreign or too small, ignored", name);
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(NULL, sizeof(sidecar_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == p)
+        return 0;
+
+    const sidecar_shm_t *s = p;
+    if (SIDECAR_MAGIC != __atomic_load_n(&s->magic, __ATOMIC_ACQUIRE) || SIDECAR_VERSION != s->version
+        || sizeof(sidecar_slot_t) != s->slot_size || SIDECAR_SLOTS != s->n_slots) {
+        log_msg("tlasxpd is of a different build, ignored");
+        munmap(p, sizeof(sidecar_shm_t));
+        return 0;
+    }
+
+    shm = s;
+    shm_dev = st.st_dev;
+    shm_ino = st.st_ino;
+    return 1;
+}
+
+/* consistent copy of a slot, return success == 1 */
+static int
+read_slot(int idx, const char *pilot_id, ofp_info_t *ofp_info)
+{
+    const sidecar_slot_t *slot = &shm->slots[idx];
+
+    for (int i = 0; i < 100; i++) {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+
+        if (slot->ofp_size != sizeof(ofp_info_t)) {
+            log_msg("tlasxpd has a different ofp_info_t layout");
+            return 0;
+        }
+
+        memcpy(ofp_info, (const void *)&slot->ofp_info, sizeof(ofp_info_t));
+        int match = (0 == strcmp((const char *)slot->pilot_id, pilot_id));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq == __atomic_load_n(&slot->seq, __ATOMIC_RELAXED))
+            return match;
+    }
+
+    return 0;
+}
+
+/*
+ * send a request line, return -1 if no daemon is available,
+ * 0 if there was no reply and 1 with the reply line in buf
+ */
+static int
+request(const char *req, char *buf, int buf_len, run_ctl_t *rc)
+{
+    struct sockaddr_un addr;
+    char sock_path[sizeof(addr.sun_path)];
+    int res = -1;
+
+    tlasxp_sidecar_names(sock_path, sizeof(sock_path), NULL, 0);
+
+    if (0 != access(sock_path, F_OK))
+        return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto out;
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    int len = strlen(req);
+    if (len != write(fd, req, len))
+        goto out;
+
+    /* we are answered, whatever happens from now on */
+    res = 0;
+
+    int n = 0;
+    while (n < buf_len - 1 && (0 == n || '\n' != buf[n - 1])) {
+        if (tlasxp_run_aborted(rc))
+            goto out;
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, 20) <= 0)
+            continue;
+
+        int l = read(fd, buf + n, buf_len - 1 - n);
+        if (l <= 0)
+            goto out;
+        n += l;
+    }
+
+    buf[n] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    res = 1;
+
+  out:
+    close(fd);
+    return res;
+}
+
+/*
+ * return -1 if no daemon is available
+ * otherwise 1 and ofp_info filled in, check status for the result
+ */
+int
+tlasxp_sidecar_fetch(const char *pilot_id, ofp_info_t *ofp_info, run_ctl_t *rc)
+{
+    char buf[200];
+
+    if (! map_shm())
+        return -1;
+
+    snprintf(buf, sizeof(buf), "FETCH %s %d\n", pilot_id, MAX_AGE);
+    int res = request(buf, buf, sizeof(buf), rc);
+    if (res < 0)
+        return -1;
+
+    memset(ofp_info, 0, sizeof(*ofp_info));
+    strcpy(ofp_info->status, "Network error");
+
+    if (0 == res) {
+        if (rc->canceled)
+            strcpy(ofp_info->status, "Canceled");
+        return 1;
+    }
+
+    int idx;
+    if (1 == sscanf(buf, "OK %d", &idx) && idx >= 0 && idx < SIDECAR_SLOTS) {
+        if (! read_slot(idx, pilot_id, ofp_info)) {
+            memset(ofp_info, 0, sizeof(*ofp_info));
+            strcpy(ofp_info->status, "Sidecar error");
+        }
+    } else if (0 == strncmp(buf, "ERR ", 4)) {
+        snprintf(ofp_info->status, sizeof(ofp_info->status), "%.*s",
+                 (int)sizeof(ofp_info->status) - 1, buf + 4);
+    }
+
+    log_msg("ofp from tlasxpd: %s", ofp_info->status);
+    return 1;
+}
+
+/*
+ * Have the daemon download an FMS plan and copy it to fn.
+ * return -1 if the daemon can't provide it, 0 on a download error and 1 on success
+ */
+int
+tlasxp_sidecar_fms(const char *url, const char *fn, run_ctl_t *rc)
+{
+    char buf[600], buffer[16 * 1024];
+    struct stat st;
+    size_t n;
+
+    snprintf(buf, sizeof(buf), "FMS %d %s\n", MAX_AGE, url);
+    int res = request(buf, buf, sizeof(buf), rc);
+    if (res <= 0)
+        return res;
+
+    if (0 == strncmp(buf, "ERR ", 4)) {
+        log_msg("FMS plan from tlasxpd: %s", buf + 4);
+        return 0;
+    }
+
+    if (strncmp(buf, "OK ", 3))
+        return -1;
+
+    /* the daemon's file may be evicted meanwhile, then we download ourselves */
+    FILE *src = fopen(buf + 3, "rb");
+    if (NULL == src)
+        return -1;
+
+    res = -1;
+    if (fstat(fileno(src), &st) < 0 || st.st_uid != getuid()) {
+        log_msg("FMS plan '%s' is foreign, ignored", buf + 3);
+        goto out;
+    }
+
+    FILE *dst = fopen(fn, "wb");
+    if (NULL == dst)
+        goto out;
+
+    while (0 < (n = fread(buffer, 1, sizeof(buffer), src)))
+        if (n != fwrite(buffer, 1, n, dst))
+            break;
+
+    if (0 == fclose(dst) && ! ferror(src) && feof(src))
+        res = 1;
+
+    log_msg("FMS plan from tlasxpd: %s", res > 0 ? "Success" : "copy error");
+
+  out:
+    fclose(src);
+    return res;
+}
+
+void
+tlasxp_sidecar_close(void)
+{
+    if (shm)
+        munmap((void *)shm, sizeof(sidecar_shm_t));
+    shm = NULL;
+}
+#endif
@@ -0,0 +1,148 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Published OFPs as immutable, refcounted snapshots.
+ *
+ * Readers on any thread get the current OFP with tlasxp_snap_acquire() and
+ * hand it back with tlasxp_snap_release(), neither locks nor waits.
+ *
+ * The current snapshot is one 64 bit word: slot index << 32 | the number of
+ * acquires through this word. Acquire is a single fetch_add, so the pointer
+ * and the reference are taken atomically. When a new OFP is published the
+ * word is exchanged and the old count is transferred to the old slot's
+ * own counter, which releases of the old snapshot decrement. A retired slot
+ * whose counter is back at 0 has no readers left and can be reused.
+ * Publishing is rare and serialized by a mutex that readers never touch.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define N_SNAP 6
+#define IDX_SHIFT 32
+#define COUNT_MASK 0xffffffffULL
+
+typedef struct _snap
+{
+    ofp_info_t *ofp;
+    int64_t refs;           /* of the retired snapshot, see above */
+} snap_t;
+
+static const ofp_info_t empty_ofp;      /* valid == 0, current until the first publish */
+static snap_t slots[N_SNAP] = { [0] = { (ofp_info_t *)&empty_ofp, 0 } };
+static uint64_t current;                /* slot 0, no readers */
+static pthread_mutex_t publish_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t publish_gen;            /* the empty OFP has 0 */
+
+const ofp_info_t *
+tlasxp_snap_acquire(void)
+{
+    uint64_t w = __atomic_fetch_add(&current, 1, __ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slots[w >> IDX_SHIFT].ofp, __ATOMIC_RELAXED);
+}
+
+void
+tlasxp_snap_release(const ofp_info_t *ofp)
+{
+    uint64_t idx = 0;
+    while (idx < N_SNAP && __atomic_load_n(&slots[idx].ofp, __ATOMIC_RELAXED) != ofp)
+        idx++;
+
+    if (N_SNAP == idx) {
+        log_msg("snap: release of an unknown snapshot");
+        return;
+    }
+
+    /* still current: undo the acquire in the word, the slot can't be recycled while we hold it */
+    uint64_t w = __atomic_load_n(&current, __ATOMIC_RELAXED);
+    while ((w >> IDX_SHIFT) == idx && (w & COUNT_MASK) > 0) {
+        if (__atomic_compare_exchange_n(&current, &w, w - 1, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+    }
+
+    __atomic_sub_fetch(&slots[idx].refs, 1, __ATOMIC_RELEASE);
+}
+
+/* make a copy of ofp the current snapshot, return success == 1 */
+int
+tlasxp_snap_publish(const ofp_info_t *ofp)
+{
+    pthread_mutex_lock(&publish_mutex);
+
+    uint64_t cur = __atomic_load_n(&current, __ATOMIC_RELAXED) >> IDX_SHIFT;
+    int idx = -1;
+    for (int i = 0; i < N_SNAP; i++) {
+        if (i != (int)cur && 0 == __atomic_load_n(&slots[i].refs, __ATOMIC_ACQUIRE)) {
+            idx = i;
+            break;
+        }
+    }
+
+    if (idx < 0) {
+        pthread_mutex_unlock(&publish_mutex);
+        log_msg("snap: all snapshots are in use, OFP not published");
+        return 0;
+    }
+
+    snap_t *s = &slots[idx];
+    /* releases scan the pointers concurrently */
+    if (NULL == s->ofp || &empty_ofp == s->ofp) {
+        ofp_info_t *p = malloc(sizeof(ofp_info_t));
+        if (NULL == p) {
+            pthread_mutex_unlock(&publish_mutex);
+            log_msg("snap: can't allocate snapshot");
+            return 0;
+        }
+
+        __atomic_store_n(&s->ofp, p, __ATOMIC_RELAXED);
+    }
+
+    *s->ofp = *ofp;
+    s->ofp->snap_gen = ++publish_gen;
+
+    uint64_t old = __atomic_exchange_n(&current, (uint64_t)idx << IDX_SHIFT, __ATOMIC_ACQ_REL);
+    __atomic_add_fetch(&slots[old >> IDX_SHIFT].refs, (int64_t)(old & COUNT_MASK), __ATOMIC_ACQ_REL);
+
+    pthread_mutex_unlock(&publish_mutex);
+    return 1;
+}
+
+/* when no reader is left */
+void
+tlasxp_snap_cleanup(void)
+{
+    for (int i = 0; i < N_SNAP; i++) {
+        if (&empty_ofp != slots[i].ofp)
+            free(slots[i].ofp);
+        slots[i].ofp = NULL;
+        slots[i].refs = 0;
+    }
+
+    slots[0].ofp = (ofp_info_t *)&empty_ofp;
+    current = 0;
+}
@@ -0,0 +1,219 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Winds and temperatures aloft along the route.
+ *
+ * SimBrief gives each navlog fix a <wind_data> block with a few levels around
+ * the cruise altitude. These are resampled onto a common set of levels and
+ * quantized into a grid of 3 byte cells, at most WIND_MAX_ROWS positions along
+ * the route, so even the longest route fits in ~3.3 KB.
+ * Direction and speed are interpolated separately, the direction along the
+ * shorter arc. All integer/float arithmetic, no libm.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tlasxp.h"
+
+static int
+clamp(int x, int lo, int hi)
+{
+    return (x < lo) ? lo : ((x > hi) ? hi : x);
+}
+
+/* a -> b by f along the shorter arc, result in [0, 360) */
+static float
+lerp_dir(float a, float b, float f)
+{
+    float d = b - a;
+    if (d > 180.0f)
+        d -= 360.0f;
+    else if (d < -180.0f)
+        d += 360.0f;
+
+    float r = a + f * d;
+    if (r < 0.0f)
+        r += 360.0f;
+    else if (r >= 360.0f)
+        r -= 360.0f;
+    return r;
+}
+
+/* value of a fix's wind_data at altitude alt, clamped to the fix's range */
+static void
+fix_at(const wind_level_t *lv, int n, int alt, float *dir, float *spd, float *oat)
+{
+    int i = 0;
+    while (i < n - 1 && lv[i + 1].altitude < alt)
+        i++;
+
+    const wind_level_t *a = &lv[i], *b = &lv[(i < n - 1) ? i + 1 : i];
+    float f = 0.0f;
+    if (b->altitude > a->altitude)
+        f = (float)clamp(alt - a->altitude, 0, b->altitude - a->altitude) / (b->altitude - a->altitude);
+
+    *dir = lerp_dir(a->dir, b->dir, f);
+    *spd = a->spd + f * (b->spd - a->spd);
+    *oat = a->oat + f * (b->oat - a->oat);
+}
+
+static void
+encode(wind_cell_t *c, float dir, float spd, float oat)
+{
+    c->dir = (int)(dir * 0.5f + 0.5f) % 180;
+    c->spd = clamp((int)(spd * 0.5f + 0.5f), 0, 255);
+    c->oat = clamp((int)(oat + ((oat < 0.0f) ? -0.5f : 0.5f)), -128, 127);
+}
+
+/*
+ * Build the grid from the parsed navlog.
+ * For fix i dist[i] is the distance along the route, levels[i * WIND_MAX_LEVELS ...]
+ * are n_levels[i] levels sorted by altitude. Fixes without levels are skipped.
+ */
+void
+tlasxp_wind_build(wind_grid_t *wg, const int *dist, const wind_level_t *levels,
+                  const int *n_levels, int n_fix)
+{
+    memset(wg, 0, sizeof(*wg));
+
+    /* the grid levels are those of the fix with the most levels */
+    int ref = -1, n_wind = 0;
+    for (int i = 0; i < n_fix; i++) {
+        if (n_levels[i] > 0)
+            n_wind++;
+        if (n_levels[i] > 0 && (ref < 0 || n_levels[i] > n_levels[ref]))
+            ref = i;
+    }
+
+    if (ref < 0)
+        return;
+
+    wg->n_levels = n_levels[ref];
+    for (int j = 0; j < wg->n_levels; j++)
+        wg->level[j] = clamp((levels[ref * WIND_MAX_LEVELS + j].altitude + 50) / 100, 0, 65535);
+
+    /* long routes: thin out to rows at least spacing apart, the last fix is always kept */
+    int last = n_fix - 1;
+    while (n_levels[last] == 0)
+        last--;
+
+    int spacing = 0;
+    if (n_wind > WIND_MAX_ROWS)
+        spacing = clamp((dist[last] + WIND_MAX_ROWS - 2) / (WIND_MAX_ROWS - 1), 1, 65535);
+
+    for (int i = 0; i <= last; i++) {
+        if (0 == n_levels[i])
+            continue;
+
+        int r = wg->n_rows;
+        if (r > 0 && dist[i] - wg->dist[r - 1] < spacing) {
+            if (i < last)
+                continue;
+            r--;        /* the last fix replaces the row before */
+        }
+
+        const wind_level_t *lv = &levels[i * WIND_MAX_LEVELS];
+        for (int j = 0; j < wg->n_levels; j++) {
+            float dir, spd, oat;
+            fix_at(lv, n_levels[i], wg->level[j] * 100, &dir, &spd, &oat);
+            encode(&wg->cell[r * wg->n_levels + j], dir, spd, oat);
+        }
+
+        wg->dist[r] = clamp(dist[i], 0, 65535);
+        wg->n_rows = r + 1;
+    }
+}
+
+static void
+decode(const wind_cell_t *c, float *dir, float *spd, float *oat)
+{
+    *dir = c->dir * 2.0f;
+    *spd = c->spd * 2.0f;
+    *oat = c->oat;
+}
+
+/* value of row r at level index l + fraction fl */
+static void
+row_at(const wind_grid_t *wg, int r, int l, float fl, float *dir, float *spd, float *oat)
+{
+    const wind_cell_t *c = &wg->cell[r * wg->n_levels + l];
+    decode(c, dir, spd, oat);
+    if (fl == 0.0f)
+        return;
+
+    float d2, s2, t2;
+    decode(c + 1, &d2, &s2, &t2);
+    *dir = lerp_dir(*dir, d2, fl);
+    *spd += fl * (s2 - *spd);
+    *oat += fl * (t2 - *oat);
+}
+
+/*
+ * Wind direction (°, from), speed (kt) and temperature (°C) at dist nm along the
+ * route and altitude alt ft. Outside of the grid the values are clamped.
+ * Returns 0 if there is no wind data.
+ */
+int
+tlasxp_wind_at(const wind_grid_t *wg, float dist, float alt, float *dir, float *spd, float *oat)
+{
+    if (0 == wg->n_rows)
+        return 0;
+
+    /* bracketing rows by binary search */
+    int lo = 0, hi = wg->n_rows - 1;
+    while (hi - lo > 1) {
+        int m = (lo + hi) / 2;
+        if (wg->dist[m] <= dist)
+            lo = m;
+        else
+            hi = m;
+    }
+
+    float fr = 0.0f;
+    if (wg->dist[hi] > wg->dist[lo] && dist > wg->dist[lo])
+        fr = (dist >= wg->dist[hi]) ? 1.0f : (dist - wg->dist[lo]) / (wg->dist[hi] - wg->dist[lo]);
+
+    /* level index and fraction, a handful of levels, linear is fine */
+    float fl_alt = alt * 0.01f;
+    int l = 0;
+    while (l < wg->n_levels - 2 && wg->level[l + 1] < fl_alt)
+        l++;
+
+    float fl = 0.0f;
+    if (wg->n_levels > 1 && fl_alt > wg->level[l])
+        fl = (fl_alt >= wg->level[l + 1]) ? 1.0f : (fl_alt - wg->level[l]) / (wg->level[l + 1] - wg->level[l]);
+
+    row_at(wg, lo, l, fl, dir, spd, oat);
+    if (fr == 0.0f)
+        return 1;
+
+    float d2, s2, t2;
+    row_at(wg, hi, l, fl, &d2, &s2, &t2);
+    *dir = lerp_dir(*dir, d2, fr);
+    *spd += fr * (s2 - *spd);
+    *oat += fr * (t2 - *oat);
+    return 1;
+}
@@ -0,0 +1,400 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * Weather along the route from ActiveSky's local API.
+ *
+ * METARs for origin, destination and alternate and the conditions at
+ * navlog fixes sampled along the route are requested concurrently.
+ * Reports are cached keyed by station and time slot so a refetch of the
+ * same OFP does not query ASXP again. XML responses are reduced to a short
+ * caption line.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tlasxp.h"
+
+#define N_WORKER 6
+#define N_CACHE 64
+#define CACHE_SLOT 900      /* s, reports are considered current for that time */
+#define SAMPLE_DIST 250     /* nm between sampled navlog fixes */
+#define POS_BUCKET 10       /* per degree, fixes closer than that share a cache entry */
+#define ALT_BUCKET 1000     /* ft */
+
+/* what a report is cached under: the ICAO code or ident, position and altitude of a fix */
+typedef struct _wx_key
+{
+    char station[8];
+    int lat, lon, alt;      /* buckets, 0 for airports */
+} wx_key_t;
+
+typedef struct _wx_query
+{
+    wx_key_t key;
+    char station[8];
+    char path[200];
+    char text[200];
+    int ok;
+} wx_query_t;
+
+typedef struct _wx_run
+{
+    wx_query_t *q;
+    int n_q;
+    volatile int next;      /* next query to process */
+    run_ctl_t *rc;
+    double timeout;
+} wx_run_t;
+
+typedef struct _cache_entry
+{
+    wx_key_t key;
+    time_t slot;
+    unsigned int last_use;
+    char text[200];
+} cache_entry_t;
+
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cache_entry_t cache[N_CACHE];
+static unsigned int cache_clock;
+static int tmp_seq;
+
+static int
+key_eq(const wx_key_t *a, const wx_key_t *b)
+{
+    return a->lat == b->lat && a->lon == b->lon && a->alt == b->alt
+           && 0 == strcmp(a->station, b->station);
+}
+
+/* return 1 and copy the text if key is cached for the current time slot */
+static int
+cache_lookup(const wx_key_t *key, time_t slot, char *text)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&cache_mutex);
+    for (int i = 0; i < N_CACHE; i++) {
+        cache_entry_t *ce = &cache[i];
+        if (ce->slot == slot && key_eq(&ce->key, key)) {
+            ce->last_use = ++cache_clock;
+            memcpy(text, ce->text, sizeof(ce->text));
+            found = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+/* insert, evicting the least recently used entry */
+static void
+cache_insert(const wx_key_t *key, time_t slot, const char *text)
+{
+    pthread_mutex_lock(&cache_mutex);
+    cache_entry_t *victim = &cache[0];
+    for (int i = 0; i < N_CACHE; i++) {
+        cache_entry_t *ce = &cache[i];
+        if (key_eq(&ce->key, key)) {    /* older slot of the same key */
+            victim = ce;
+            break;
+        }
+        if (ce->last_use < victim->last_use)
+            victim = ce;
+    }
+
+    victim->key = *key;
+    victim->slot = slot;
+    victim->last_use = ++cache_clock;
+    memcpy(victim->text, text, sizeof(victim->text));
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/* copy s .. s + len to text squeezing whitespace, return the new length */
+static int
+squeeze(const char *s, int len, char *text, int n, int text_len)
+{
+    int space = (n > 0);
+
+    for (int i = 0; i < len && n < text_len - 1; i++) {
+        if (isspace((unsigned char)s[i])) {
+            space = (n > 0);
+            continue;
+        }
+
+        if (space && n < text_len - 2)
+            text[n++] = ' ';
+        space = 0;
+        text[n++] = s[i];
+    }
+
+    text[n] = '\0';
+    return n;
+}
+
+/* text of the first of the '|' separated elements in tags, case insensitive */
+static int
+element_text(const char *xml, const char *tags, char *buf, int buf_len)
+{
+    char tag[30];
+
+    while (*tags) {
+        int l = strcspn(tags, "|");
+        snprintf(tag, sizeof(tag), "%.*s", l, tags);
+        tags += l + ('|' == tags[l]);
+
+        for (const char *s = strchr(xml, '<'); s; s = strchr(s + 1, '<')) {
+            if (strncasecmp(s + 1, tag, l) || ('>' != s[l + 1] && ' ' != s[l + 1]))
+                continue;
+
+            if (NULL == (s = strchr(s, '>')) || '/' == s[-1])
+                break;
+
+            const char *e = strchr(++s, '<');
+            if (NULL == e)
+                break;
+
+            squeeze(s, e - s, buf, 0, buf_len);
+            if (buf[0])
+                return 1;
+            break;
+        }
+    }
+
+    buf[0] = '\0';
+    return 0;
+}
+
+/*
+ * Make a caption line from a response: a METAR as is, XML reduced to the
+ * METAR it contains or to wind, temperature and visibility. Anything else
+ * loses its markup.
+ */
+static void
+summarize(const char *resp, char *text, int text_len)
+{
+    const char *xml = resp + strspn(resp, " \t\r\n");
+    char val[40];
+    int n = 0;
+
+    if ('<' != xml[0]) {
+        squeeze(xml, strlen(xml), text, 0, text_len);
+        return;
+    }
+
+    if (element_text(xml, "METAR|RawMetar|MetarText", text, text_len))
+        return;
+
+    text[0] = '\0';
+    char wdir[10];
+    if (element_text(xml, "WindDirection|WindDir", wdir, sizeof(wdir))
+        && element_text(xml, "WindSpeed|WindSpd", val, sizeof(val)))
+        n += snprintf(text + n, text_len - n, "Wind %s/%s ", wdir, val);
+
+    if (n < text_len && element_text(xml, "Temperature|Temp|OAT", val, sizeof(val)))
+        n += snprintf(text + n, text_len - n, "T %sC ", val);
+
+    if (n < text_len && element_text(xml, "Visibility|Vis", val, sizeof(val)))
+        n += snprintf(text + n, text_len - n, "Vis %s ", val);
+
+    n = strlen(text);
+    if (n > 0) {
+        while (' ' == text[n - 1])
+            text[--n] = '\0';
+        return;
+    }
+
+    /* unknown layout, the element texts */
+    for (const char *s = xml; NULL != (s = strchr(s, '>')); ) {
+        const char *e = strchr(++s, '<');
+        if (NULL == e)
+            e = s + strlen(s);
+        n = squeeze(s, e - s, text, n, text_len);
+        s = e;
+    }
+}
+
+/* read the response into a caption line */
+static void
+read_text(FILE *f, char *text, int text_len)
+{
+    char resp[4096];
+
+    rewind(f);
+    int len = fread(resp, 1, sizeof(resp) - 1, f);
+    resp[len] = '\0';
+    summarize(resp, text, text_len);
+}
+
+static void *
+wx_worker(void *arg)
+{
+    wx_run_t *run = arg;
+    char fn[600];
+
+    snprintf(fn, sizeof(fn), "%s.wx%d", tlasxp_tmp_fn,
+             __atomic_add_fetch(&tmp_seq, 1, __ATOMIC_RELAXED));
+
+    while (1) {
+        int i = __atomic_fetch_add(&run->next, 1, __ATOMIC_RELAXED);
+        if (i >= run->n_q || tlasxp_run_aborted(run->rc))
+            break;
+
+        wx_query_t *q = &run->q[i];
+        FILE *f = fopen(fn, "wb+");
+        if (NULL == f) {
+            log_msg("Can't create file '%s'", fn);
+            break;
+        }
+
+        char url[300];
+        snprintf(url, sizeof(url), "%s%s", ASXP_URL, q->path);
+        if (tlasxp_http_get(url, f, NULL, run->rc, run->timeout)) {
+            read_text(f, q->text, sizeof(q->text));
+            q->ok = 1;
+        }
+
+        fclose(f);
+    }
+
+    remove(fn);
+    return NULL;
+}
+
+static void
+add_airport(wx_query_t *q, int *n_q, const char *icao)
+{
+    if ('\0' == icao[0] || *n_q >= MAX_WX)
+        return;
+
+    wx_query_t *qq = &q[(*n_q)++];
+    snprintf(qq->station, sizeof(qq->station), "%.*s", (int)sizeof(qq->station) - 1, icao);
+    qq->key.lat = qq->key.lon = qq->key.alt = 0;
+    strcpy(qq->key.station, qq->station);
+    snprintf(qq->path, sizeof(qq->path), "/ActiveSky/API/GetMetarInfoAt?ICAO=%s", icao);
+}
+
+static void
+add_fix(wx_query_t *q, int *n_q, const navlog_fix_t *fix)
+{
+    if (*n_q >= MAX_WX)
+        return;
+
+    wx_query_t *qq = &q[(*n_q)++];
+    snprintf(qq->station, sizeof(qq->station), "%s", fix->ident);
+    strcpy(qq->key.station, qq->station);
+    qq->key.lat = (int)(fix->lat * POS_BUCKET + (fix->lat >= 0.0f ? 0.5f : -0.5f));
+    qq->key.lon = (int)(fix->lon * POS_BUCKET + (fix->lon >= 0.0f ? 0.5f : -0.5f));
+    qq->key.alt = (fix->altitude + ALT_BUCKET / 2) / ALT_BUCKET;
+    snprintf(qq->path, sizeof(qq->path), "/ActiveSky/API/GetWeatherInfoXml?lat=%0.4f&lon=%0.4f&alt=%d",
+             fix->lat, fix->lon, fix->altitude);
+}
+
+/* return # of reports */
+int
+tlasxp_wx_prefetch(const ofp_info_t *ofp_info, wx_info_t *wx_info, run_ctl_t *rc, double timeout)
+{
+    wx_query_t q[MAX_WX];
+    int n_q = 0;
+
+    memset(q, 0, sizeof(q));
+    wx_info->n_wx = 0;
+
+    add_airport(q, &n_q, ofp_info->origin);
+    add_airport(q, &n_q, ofp_info->destination);
+    add_airport(q, &n_q, ofp_info->alternate);
+
+    /* sample the enroute part of the navlog */
+    int next_dist = SAMPLE_DIST;
+    for (int i = 0; i < ofp_info->n_navlog; i++) {
+        const navlog_fix_t *fix = &ofp_info->navlog[i];
+        if (fix->distance >= next_dist && strcmp(fix->type, "apt")) {
+            add_fix(q, &n_q, fix);
+            next_dist = fix->distance + SAMPLE_DIST;
+        }
+    }
+
+    /* satisfy what we can from the cache */
+    time_t slot = time(NULL) / CACHE_SLOT;
+    wx_info->slot = slot;
+    wx_query_t *todo[MAX_WX];
+    int n_todo = 0;
+    for (int i = 0; i < n_q; i++) {
+        if (cache_lookup(&q[i].key, slot, q[i].text))
+            q[i].ok = 1;
+        else
+            todo[n_todo++] = &q[i];
+    }
+
+    if (n_todo > 0) {
+        /* workers process a compacted copy */
+        wx_query_t qt[MAX_WX];
+        for (int i = 0; i < n_todo; i++)
+            qt[i] = *todo[i];
+
+        wx_run_t run = { .q = qt, .n_q = n_todo, .next = 0, .rc = rc, .timeout = timeout };
+        pthread_t tid[N_WORKER];
+        int n_worker = 0;
+        for (int i = 0; i < N_WORKER && i < n_todo; i++)
+            if (0 == pthread_create(&tid[n_worker], NULL, wx_worker, &run))
+                n_worker++;
+
+        if (0 == n_worker)
+            wx_worker(&run);
+
+        for (int i = 0; i < n_worker; i++)
+            pthread_join(tid[i], NULL);
+
+        for (int i = 0; i < n_todo; i++) {
+            *todo[i] = qt[i];
+            if (qt[i].ok)
+                cache_insert(&qt[i].key, slot, qt[i].text);
+        }
+    }
+
+    for (int i = 0; i < n_q; i++) {
+        if (! q[i].ok)
+            continue;
+
+        int j = wx_info->n_wx++;
+        strcpy(wx_info->wx[j].station, q[i].station);
+        strcpy(wx_info->wx[j].text, q[i].text);
+    }
+
+    log_msg("wx: %d reports, %d queried from ASXP", wx_info->n_wx, n_todo);
+    return wx_info->n_wx;
+}
+
+/* reports are still from the current cache slot */
+int
+tlasxp_wx_current(const wx_info_t *wx_info)
+{
+    return wx_info->n_wx > 0 && wx_info->slot == time(NULL) / CACHE_SLOT;
+}
@@ -0,0 +1,403 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/*
+ * tlasxpd: optional fetch daemon for hosts running several X-Plane instances.
+ *
+ * It does the SimBrief downloads that all instances would repeat: the OFP
+ * and the FMS plan. Plugin instances send
+ *   FETCH <pilot_id> <max_age>\n
+ *   FMS <max_age> <url>\n
+ * over a Unix socket and get back
+ *   OK <slot>\n        the parsed OFP is in shared memory slot <slot>
+ *   OK <path>\n        the FMS plan is in file <path>
+ *   ERR <status>\n
+ *
+ * Identical requests that arrive while a fetch is running wait for that
+ * fetch, results younger than max_age are served from shared memory or
+ * the daemon's FMS directory. Asset prefetch, ASXP and weather traffic stay
+ * with the instances, they go to a per instance cache or the local ASXP.
+ *
+ * Socket, shared memory and FMS directory are accessible by the user running
+ * the daemon only.
+ *
+ * call with
+ * tlasxpd [socket_path]
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tlasxp.h"
+
+#define FETCH_BUDGET 15.0
+#define FMS_TIMEOUT 10.0
+#define FMS_SLOTS 16
+
+char tlasxp_tmp_fn[100];
+
+/* the daemon's view of the shared memory slots */
+typedef struct _entry
+{
+    char pilot_id[20];
+    int busy;           /* fetch in progress */
+    int ok;
+    double t_done;
+    double last_use;
+    char status[100];
+} entry_t;
+
+/* a downloaded FMS plan, the file name is derived from the url */
+typedef struct _fms_entry
+{
+    char url[400];
+    int busy;
+    int ok;
+    double t_done;
+    double last_use;
+    char fn[200];
+} fms_entry_t;
+
+static pthread_mutex_t d_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t d_cond = PTHREAD_COND_INITIALIZER;
+static entry_t entry[SIDECAR_SLOTS];
+static fms_entry_t fms_entry[FMS_SLOTS];
+static char fms_dir[100];
+static sidecar_shm_t *shm;
+static int n_fetch, n_dedup, n_cached;
+
+static void
+write_slot(int idx, const char *pilot_id, const ofp_info_t *ofp_info)
+{
+    sidecar_slot_t *slot = &shm->slots[idx];
+
+    __atomic_add_fetch(&slot->seq, 1, __ATOMIC_ACQ_REL);    /* odd: write in progress */
+    slot->ofp_size = sizeof(ofp_info_t);
+    strcpy(slot->pilot_id, pilot_id);
+    memcpy(&slot->ofp_info, ofp_info, sizeof(ofp_info_t));
+    __atomic_add_fetch(&slot->seq, 1, __ATOMIC_RELEASE);
+}
+
+/* d_mutex must be held, return -1 if all are busy */
+static int
+find_entry(const char *pilot_id)
+{
+    int victim = -1;
+
+    for (int i = 0; i < SIDECAR_SLOTS; i++) {
+        if (0 == strcmp(entry[i].pilot_id, pilot_id))
+            return i;
+
+        if (! entry[i].busy && (victim < 0 || entry[i].last_use < entry[victim].last_use))
+            victim = i;
+    }
+
+    if (victim >= 0) {
+        memset(&entry[victim], 0, sizeof(entry_t));
+        strcpy(entry[victim].pilot_id, pilot_id);
+    }
+
+    return victim;
+}
+
+/* return slot index or -1, status is filled in */
+static int
+fetch(const char *pilot_id, int max_age, char *status, int status_len)
+{
+    pthread_mutex_lock(&d_mutex);
+
+    int idx = find_entry(pilot_id);
+    if (idx < 0) {
+        snprintf(status, status_len, "Sidecar busy");
+        goto out;
+    }
+
+    entry_t *e = &entry[idx];
+    if (e->busy) {
+        n_dedup++;
+        while (e->busy)
+            pthread_cond_wait(&d_cond, &d_mutex);
+
+        /* may have been evicted meanwhile */
+        if (strcmp(e->pilot_id, pilot_id)) {
+            snprintf(status, status_len, "Sidecar busy");
+            idx = -1;
+            goto out;
+        }
+    } else if (e->t_done > 0.0 && e->ok && tlasxp_now() - e->t_done <= max_age) {
+        n_cached++;
+    } else {
+        n_fetch++;
+        e->busy = 1;
+        pthread_mutex_unlock(&d_mutex);
+
+        /* the model and all parse buffers of the fetch */
+        arena_t arena;
+        tlasxp_arena_init(&arena, 0);
+        ofp_info_t *oi = tlasxp_arena_alloc(&arena, sizeof(ofp_info_t));
+        run_ctl_t rc;
+        tlasxp_run_init(&rc, FETCH_BUDGET);
+        if (oi) {
+            tlasxp_ofp_get_parse(pilot_id, oi, &rc, &arena);
+        }
+
+        pthread_mutex_lock(&d_mutex);
+        if (oi) {
+            write_slot(idx, pilot_id, oi);
+            e->ok = (0 == strcmp(oi->status, "Success"));
+            snprintf(e->status, sizeof(e->status), "%s", oi->status);
+        } else {
+            e->ok = 0;
+            strcpy(e->status, "Out of memory");
+        }
+
+        tlasxp_arena_release(&arena);
+        e->t_done = tlasxp_now();
+        e->busy = 0;
+        pthread_cond_broadcast(&d_cond);
+        log_msg("fetches: %d, deduplicated: %d, cached: %d", n_fetch, n_dedup, n_cached);
+    }
+
+    e->last_use = tlasxp_now();
+    snprintf(status, status_len, "%s", e->status);
+    if (! e->ok)
+        idx = -1;
+
+  out:
+    pthread_mutex_unlock(&d_mutex);
+    return idx;
+}
+
+/* d_mutex must be held, return -1 if all are busy */
+static int
+find_fms_entry(const char *url)
+{
+    int victim = -1;
+
+    for (int i = 0; i < FMS_SLOTS; i++) {
+        if (0 == strcmp(fms_entry[i].url, url))
+            return i;
+
+        if (! fms_entry[i].busy && (victim < 0 || fms_entry[i].last_use < fms_entry[victim].last_use))
+            victim = i;
+    }
+
+    if (victim >= 0) {
+        fms_entry_t *e = &fms_entry[victim];
+        if (e->fn[0])
+            remove(e->fn);
+        memset(e, 0, sizeof(fms_entry_t));
+        snprintf(e->url, sizeof(e->url), "%s", url);
+        snprintf(e->fn, sizeof(e->fn), "%s/%016llx.fms", fms_dir,
+                 (unsigned long long)tlasxp_hash(url, strlen(url), 0));
+    }
+
+    return victim;
+}
+
+/* download url into the FMS directory, return success == 1 and the file name */
+static int
+fetch_fms(const char *url, int max_age, char *fn, int fn_len, char *status, int status_len)
+{
+    int res = 0;
+
+    pthread_mutex_lock(&d_mutex);
+
+    int idx = find_fms_entry(url);
+    if (idx < 0) {
+        snprintf(status, status_len, "Sidecar busy");
+        goto out;
+    }
+
+    fms_entry_t *e = &fms_entry[idx];
+    if (e->busy) {
+        n_dedup++;
+        while (e->busy)
+            pthread_cond_wait(&d_cond, &d_mutex);
+
+        if (strcmp(e->url, url)) {
+            snprintf(status, status_len, "Sidecar busy");
+            goto out;
+        }
+    } else if (e->t_done > 0.0 && e->ok && tlasxp_now() - e->t_done <= max_age) {
+        n_cached++;
+    } else {
+        char tmp_fn[220];
+        n_fetch++;
+        e->busy = 1;
+        snprintf(tmp_fn, sizeof(tmp_fn), "%s.tmp", e->fn);
+        pthread_mutex_unlock(&d_mutex);
+
+        /* readers keep the old plan until the new one is complete */
+        int ok = 0;
+        FILE *f = fopen(tmp_fn, "wb");
+        if (f) {
+            run_ctl_t rc;
+            tlasxp_run_init(&rc, FETCH_BUDGET);
+            ok = tlasxp_http_get_retry(url, f, NULL, &rc, FMS_TIMEOUT);
+            ok = (0 == fclose(f)) && ok && tlasxp_replace_file(tmp_fn, e->fn);
+        }
+
+        if (! ok)
+            remove(tmp_fn);
+
+        pthread_mutex_lock(&d_mutex);
+        e->ok = ok;
+        e->t_done = tlasxp_now();
+        e->busy = 0;
+        pthread_cond_broadcast(&d_cond);
+        log_msg("fetches: %d, deduplicated: %d, cached: %d", n_fetch, n_dedup, n_cached);
+    }
+
+    e->last_use = tlasxp_now();
+    res = e->ok;
+    if (res)
+        snprintf(fn, fn_len, "%s", e->fn);
+    else
+        snprintf(status, status_len, "Can't download FMS plan");
+
+  out:
+    pthread_mutex_unlock(&d_mutex);
+    return res;
+}
+
+static void *
+client_thread(void *arg)
+{
+    int fd = (int)(intptr_t)arg;
+    char buf[600], pilot_id[20], status[100], url[400], fn[200];
+    int n = 0, max_age;
+
+    while (n < (int)sizeof(buf) - 1 && (0 == n || '\n' != buf[n - 1])) {
+        int l = read(fd, buf + n, sizeof(buf) - 1 - n);
+        if (l <= 0)
+            goto out;
+        n += l;
+    }
+    buf[n] = '\0';
+
+    if (2 == sscanf(buf, "FETCH %19s %d", pilot_id, &max_age)) {
+        int idx = fetch(pilot_id, max_age, status, sizeof(status));
+        if (idx >= 0)
+            n = snprintf(buf, sizeof(buf), "OK %d\n", idx);
+        else
+            n = snprintf(buf, sizeof(buf), "ERR %s\n", status);
+    } else if (fms_dir[0] && 2 == sscanf(buf, "FMS %d %399s", &max_age, url)) {
+        if (fetch_fms(url, max_age, fn, sizeof(fn), status, sizeof(status)))
+            n = snprintf(buf, sizeof(buf), "OK %s\n", fn);
+        else
+            n = snprintf(buf, sizeof(buf), "ERR %s\n", status);
+    } else {
+        n = snprintf(buf, sizeof(buf), "ERR Bad request\n");
+    }
+
+    if (n != write(fd, buf, n))
+        log_msg("can't send reply");
+
+  out:
+    close(fd);
+    return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+    struct sockaddr_un addr;
+    char sock_path[sizeof(addr.sun_path)], shm_name[64];
+
+    tlasxp_sidecar_names(sock_path, sizeof(sock_path), shm_name, sizeof(shm_name));
+    if (argc > 1)
+        snprintf(sock_path, sizeof(sock_path), "%s", argv[1]);
+    snprintf(tlasxp_tmp_fn, sizeof(tlasxp_tmp_fn), "/tmp/tlasxpd-%u_xml.tmp", (unsigned)getuid());
+
+    signal(SIGPIPE, SIG_IGN);
+    umask(077);     /* socket, shared memory and temp files are ours only */
+
+    /* FMS plans are served only from a directory that is ours */
+    struct stat st;
+    snprintf(fms_dir, sizeof(fms_dir), "/tmp/tlasxpd-%u.fms", (unsigned)getuid());
+    mkdir(fms_dir, 0700);
+    if (lstat(fms_dir, &st) < 0 || ! S_ISDIR(st.st_mode) || st.st_uid != getuid()
+        || (st.st_mode & 077)) {
+        log_msg("can't use '%s', FMS plans are not served", fms_dir);
+        fms_dir[0] = '\0';
+    }
+
+    /* a fresh segment, clients still mapping an old one notice the new inode */
+    shm_unlink(shm_name);
+    int shm_fd = shm_open(shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (shm_fd < 0 || ftruncate(shm_fd, sizeof(sidecar_shm_t)) < 0) {
+        log_msg("can't create shared memory '%s'", shm_name);
+        exit(1);
+    }
+
+    shm = mmap(NULL, sizeof(sidecar_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    close(shm_fd);
+    if (MAP_FAILED == shm) {
+        log_msg("can't map shared memory");
+        exit(1);
+    }
+
+    memset(shm, 0, sizeof(sidecar_shm_t));
+    shm->version = SIDECAR_VERSION;
+    shm->slot_size = sizeof(sidecar_slot_t);
+    shm->n_slots = SIDECAR_SLOTS;
+    __atomic_store_n(&shm->magic, SIDECAR_MAGIC, __ATOMIC_RELEASE);
+    tlasxp_http_init();
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", sock_path);
+    unlink(sock_path);
+
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+        log_msg("can't listen on '%s'", sock_path);
+        exit(1);
+    }
+
+    log_msg("tlasxpd listening on '%s'", sock_path);
+
+    while (1) {
+        int cfd = accept(fd, NULL, NULL);
+        if (cfd < 0)
+            continue;
+
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, client_thread, (void *)(intptr_t)cfd)) {
+            close(cfd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
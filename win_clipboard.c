@@ -0,0 +1,62 @@
+/*
+MIT License
+
+Copyright (c) 2023 Holger Teutsch
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+/* clipboard access for Windows */
+
+#include <stdio.h>
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+
+#include "tlasxp.h"
+
+/* copy the clipboard text into buffer, 0 terminated, return # of bytes */
+int
+get_clipboard(char *buffer, int buflen)
+{
+    int len = 0;
+    buffer[0] = '\0';
+
+    if (! OpenClipboard(NULL)) {
+        log_msg("can't open clipboard");
+        return 0;
+    }
+
+    HANDLE h = GetClipboardData(CF_TEXT);
+    if (h) {
+        const char *text = GlobalLock(h);
+        if (text) {
+            len = strlen(text);
+            if (len > buflen - 1)
+                len = buflen - 1;
+            memcpy(buffer, text, len);
+            buffer[len] = '\0';
+            GlobalUnlock(h);
+        }
+    }
+
+    CloseClipboard();
+    return len;
+}